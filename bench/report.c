@@ -0,0 +1,74 @@
+/*
+ * Benchmark report, linked into every benchmark binary
+ *
+ * Copyright (c) 2014, 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* At exit, write the run's wall time, collections, total and longest pause,
+ * time spent marking, and peak RSS, as the tail of a CSV row, to the file
+ * named by GGGGC_BENCH_REPORT. Collectors without the statistics API (gembc)
+ * are built with GGGGC_BENCH_NO_STATS, and leave those columns empty */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+#include "ggggc/gc.h"
+
+static double started;
+
+static double now()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void report()
+{
+    const char *filename;
+    FILE *f;
+    struct rusage ru;
+#ifndef GGGGC_BENCH_NO_STATS
+    struct GGGGC_Stats stats;
+#endif
+    double wall = now() - started;
+
+    if (!(filename = getenv("GGGGC_BENCH_REPORT"))) return;
+    if (!(f = fopen(filename, "w"))) {
+        perror(filename);
+        return;
+    }
+
+    fprintf(f, "%.6f,", wall);
+#ifndef GGGGC_BENCH_NO_STATS
+    ggggc_getStats(&stats);
+    fprintf(f, "%lu,%.6f,%.6f,%.6f,", (unsigned long) stats.collections,
+        stats.pauseTotal, stats.pauseMax, stats.phaseTotal[GGGGC_PHASE_MARK]);
+#else
+    fprintf(f, ",,,,");
+#endif
+    getrusage(RUSAGE_SELF, &ru);
+    fprintf(f, "%ld\n", (long) ru.ru_maxrss);
+
+    fclose(f);
+}
+
+static void __attribute__((constructor)) start()
+{
+    started = now();
+    atexit(report);
+}
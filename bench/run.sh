@@ -0,0 +1,54 @@
+#!/bin/sh
+# Run each benchmark in bin/ on each collector it was built for, in each heap
+# configuration, RUNS times, and write the results as CSV to stdout
+cd "`dirname $0`"
+set -e
+
+RUNS=${RUNS:-3}
+BT_DEPTH=${BT_DEPTH:-16}
+
+# heap configurations: a name, then the heap policy environment for it,
+# comma-separated. gembc has no heap policy, so runs only the default
+CONFIGS=${CONFIGS:-"default: tight:GGGGC_MIN_FREE=10,GGGGC_MAX_FREE=30 roomy:GGGGC_MIN_FREE=75,GGGGC_MAX_FREE=95"}
+
+report=${TMPDIR:-/tmp}/ggggc-bench.$$
+trap 'rm -f "$report"' EXIT
+
+benchArgs() {
+    case "$1" in
+        btggggc|btggggcth) echo $BT_DEPTH ;;
+    esac
+}
+
+echo "benchmark,collector,config,run,wall_s,gcs,pause_total_s,pause_max_s,mark_s,peak_rss_kb"
+for collector in ms semis gembc
+do
+    for bin in bin/$collector/*
+    do
+        [ -x "$bin" ] || continue
+        bench=`basename $bin`
+        for config in $CONFIGS
+        do
+            name=${config%%:*}
+            envs=`echo "${config#*:}" | tr , ' '`
+            if [ "$collector" = gembc -a "$name" != default ]
+            then
+                continue
+            fi
+
+            run=1
+            while [ $run -le $RUNS ]
+            do
+                rm -f "$report"
+                if env $envs GGGGC_BENCH_REPORT="$report" $bin `benchArgs $bench` > /dev/null &&
+                   [ -s "$report" ]
+                then
+                    echo "$bench,$collector,$name,$run,`cat "$report"`"
+                else
+                    echo "$bench on $collector ($name) failed" >&2
+                fi
+                run=`expr $run + 1`
+            done
+        done
+    done
+done
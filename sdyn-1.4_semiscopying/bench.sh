@@ -0,0 +1,92 @@
+#!/bin/bash
+# Run each benchmark in bench/ BENCH_RUNS times, checking its output, and
+# report the median time, collections and GC pause. With -s, save the medians
+# as the baseline; otherwise compare against the saved baseline, and fail if
+# any benchmark is more than BENCH_THRESHOLD percent slower.
+set -e
+cd "`dirname $0`"
+
+RUNS=${BENCH_RUNS:-5}
+THRESHOLD=${BENCH_THRESHOLD:-10}
+BASELINE=bench/baseline
+
+save=0
+if [ "$1" = "-s" ]
+then
+    save=1
+fi
+
+tmp=`mktemp -d`
+trap 'rm -rf "$tmp"' EXIT
+
+# the median of the numbers on stdin
+median() {
+    sort -n | awk '{ v[NR] = $1 } END { if (NR % 2) print v[(NR + 1) / 2]; else print (v[NR / 2] + v[NR / 2 + 1]) / 2 }'
+}
+
+TIMEFORMAT=%R
+regressed=0
+[ $save = 1 ] && : > "$tmp/baseline"
+printf '%-12s %9s %6s %9s %9s %9s %8s\n' benchmark time_s gcs pause_s max_pause baseline change
+for i in bench/*.sdyn
+do
+    nm=`basename $i .sdyn`
+    : > "$tmp/times"; : > "$tmp/gcs"; : > "$tmp/pauses"; : > "$tmp/maxes"
+    run=0
+    while [ $run -lt $RUNS ]
+    do
+        # the collector logs each collection (and each pause to start a
+        # concurrent mark) as JSON on GGGGC_EVENT_FD
+        { time GGGGC_EVENT_FD=3 ./sdyn $i > "$tmp/out" 2> "$tmp/err" 3> "$tmp/events" ; } 2>> "$tmp/times"
+        if ! cmp -s "$tmp/out" bench/correct/$nm
+        then
+            printf '%s: wrong output\n' $nm >&2
+            diff -u bench/correct/$nm "$tmp/out" >&2 || true
+            exit 1
+        fi
+        grep -c '"event":"collection"' "$tmp/events" >> "$tmp/gcs" || true
+        sed -n 's/.*"pause":\([0-9.e-]*\).*/\1/p' "$tmp/events" |
+            awk '{ t += $1; if ($1 > m) m = $1 } END { printf "%.6f %.6f\n", t, m }' > "$tmp/pause"
+        cut -d' ' -f1 "$tmp/pause" >> "$tmp/pauses"
+        cut -d' ' -f2 "$tmp/pause" >> "$tmp/maxes"
+        run=$((run + 1))
+    done
+
+    time=`median < "$tmp/times"`
+    gcs=`median < "$tmp/gcs"`
+    pause=`median < "$tmp/pauses"`
+    maxPause=`median < "$tmp/maxes"`
+
+    base=-
+    change=-
+    if [ $save = 1 ]
+    then
+        echo "$nm $time" >> "$tmp/baseline"
+    elif [ -f $BASELINE ]
+    then
+        base=`awk -v nm=$nm '$1 == nm { print $2 }' $BASELINE`
+        if [ -n "$base" ]
+        then
+            change=`awk -v t=$time -v b=$base 'BEGIN { printf "%+.1f%%", (t - b) * 100 / b }'`
+            if awk -v t=$time -v b=$base -v th=$THRESHOLD 'BEGIN { exit !(t > b * (1 + th / 100)) }'
+            then
+                change="$change!"
+                regressed=1
+            fi
+        else
+            base=-
+        fi
+    fi
+
+    printf '%-12s %9s %6s %9s %9s %9s %8s\n' $nm $time $gcs $pause $maxPause $base $change
+done
+
+if [ $save = 1 ]
+then
+    cp "$tmp/baseline" $BASELINE
+    printf 'Saved as %s\n' $BASELINE
+elif [ $regressed = 1 ]
+then
+    printf 'Regressed by more than %s%% (marked !)\n' $THRESHOLD >&2
+    exit 1
+fi
@@ -0,0 +1,101 @@
+/*
+ * Allocation functions (mmap with huge pages)
+ *
+ * Copyright (c) 2014, 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* the huge page size to assume if the system won't tell us */
+#ifndef GGGGC_HUGE_PAGE_BYTES
+#define GGGGC_HUGE_PAGE_BYTES ((ggc_size_t) 2 << 20)
+#endif
+
+/* the system's (default) huge page size */
+static ggc_size_t hugePageBytes()
+{
+    static ggc_size_t size;
+    FILE *meminfo;
+    char line[128];
+    unsigned long kb;
+
+    if (size) return size;
+    size = GGGGC_HUGE_PAGE_BYTES;
+    if ((meminfo = fopen("/proc/meminfo", "r"))) {
+        while (fgets(line, sizeof(line), meminfo)) {
+            if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+                size = (ggc_size_t) kb << 10;
+                break;
+            }
+        }
+        fclose(meminfo);
+    }
+    return size;
+}
+
+/* map an aligned pool with the given extra flags, or return NULL */
+static struct GGGGC_Pool *mapPool(int flags)
+{
+    unsigned char *space, *aspace;
+    struct GGGGC_Pool *ret;
+
+    /* allocate enough space that we can align it later */
+    space = (unsigned char *) mmap(NULL, GGGGC_POOL_BYTES*2, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON|flags, -1, 0);
+    if (space == MAP_FAILED)
+        return NULL;
+
+    /* align it */
+    ret = GGGGC_POOL_OF(space + GGGGC_POOL_BYTES - 1);
+    aspace = (unsigned char *) ret;
+
+    /* free unused space */
+    if (aspace > space)
+        munmap(space, aspace - space);
+    munmap(aspace + GGGGC_POOL_BYTES, space + GGGGC_POOL_BYTES - aspace);
+
+    return ret;
+}
+
+/* allocate a pool on huge pages, if the policy asks for them. Pools are
+ * mapped from the hugetlb pool where the system has one reserved, or else
+ * advised to use transparent huge pages. Returns NULL if neither works, or if
+ * huge pages aren't wanted */
+static struct GGGGC_Pool *allocHugePool(int *hugetlb)
+{
+    struct GGGGC_HeapPolicy pol;
+    struct GGGGC_Pool *ret;
+
+    ggggc_getHeapPolicy(&pol);
+    if (!pol.hugePages) return NULL;
+
+#ifdef MAP_HUGETLB
+    /* hugetlb mappings can only be split on huge page boundaries */
+    if (GGGGC_POOL_BYTES % hugePageBytes() == 0 &&
+        (ret = mapPool(MAP_HUGETLB))) {
+        *hugetlb = 1;
+        return ret;
+    }
+#endif
+
+#ifdef MADV_HUGEPAGE
+    if ((ret = mapPool(0))) {
+        if (madvise(ret, GGGGC_POOL_BYTES, MADV_HUGEPAGE) == 0) {
+            *hugetlb = 0;
+            return ret;
+        }
+        munmap(ret, GGGGC_POOL_BYTES);
+    }
+#endif
+
+    return NULL;
+}
@@ -75,14 +75,54 @@ extern "C" {
 
 #endif
 
+/* and huge pages for pools, if asked for and supported */
+#if defined(MAP_ANON) && !defined(GGGGC_ALLOCATOR_MALLOC) && \
+    (defined(MAP_HUGETLB) || defined(MADV_HUGEPAGE))
+#define GGGGC_HUGE_PAGES_AVAILABLE 1
+#include "allocate-huge.c"
+#endif
+
+/* how many pools have been allocated with each kind of page */
+static ggc_mutex_t hugePageCountsLock = GGC_MUTEX_INITIALIZER;
+static struct GGGGC_HugePageCounts hugePageCounts;
+
 /* pools which are freely available */
 static ggc_mutex_t freePoolsLock = GGC_MUTEX_INITIALIZER;
 static struct GGGGC_Pool *freePoolsHead, *freePoolsTail;
 
+/* unused memory can be given back to the OS, to read as zeroes when it's next
+ * touched. MADV_FREE would be cheaper, but the memory would still count
+ * against us until the OS wanted it */
+#if _POSIX_VERSION && defined(MADV_DONTNEED)
+#define GGGGC_DECOMMIT_MADVISE 1
+#endif
+
+void ggggc_decommit(void *from, void *to)
+{
+#ifdef GGGGC_DECOMMIT_MADVISE
+    static ggc_size_t pageSize;
+    ggc_size_t fromP, toP;
+
+    if (!pageSize) pageSize = sysconf(_SC_PAGESIZE);
+
+    /* hugetlb pages are reserved for us anyway, and faulting them back in
+     * could fail if the system ran out */
+    if ((ggc_size_t) to <= (ggc_size_t) from || GGGGC_POOL_OF(from)->hugetlb)
+        return;
+
+    /* only whole pages within the range */
+    fromP = ((ggc_size_t) from + pageSize - 1) & ~(pageSize - 1);
+    toP = (ggc_size_t) to & ~(pageSize - 1);
+    if (toP > fromP)
+        madvise((void *) fromP, toP - fromP, MADV_DONTNEED);
+#endif
+}
+
 /* allocate and initialize a pool */
 struct GGGGC_Pool *ggggc_newPool(int mustSucceed)
 {
     struct GGGGC_Pool *ret;
+    int huge, hugetlb;
 #ifdef GGGGC_DEBUG_TINY_HEAP
     static ggc_thread_local int allocationsLeft = GGGGC_GENERATIONS;
 
@@ -97,6 +137,7 @@ struct GGGGC_Pool *ggggc_newPool(int mustSucceed)
 #endif
 
     ret = NULL;
+    hugetlb = 0;
 
     /* try to reuse a pool */
     if (freePoolsHead) {
@@ -109,67 +150,220 @@ struct GGGGC_Pool *ggggc_newPool(int mustSucceed)
         ggc_mutex_unlock(&freePoolsLock);
     }
 
-    /* otherwise, allocate one */
-    if (!ret) ret = (struct GGGGC_Pool *) allocPool(mustSucceed);
-
-    if (!ret) return NULL;
+    /* otherwise, allocate one, with huge pages if wanted */
+    if (!ret) {
+#ifdef GGGGC_HUGE_PAGES_AVAILABLE
+        ret = allocHugePool(&hugetlb);
+#endif
+        huge = !!ret;
+        if (!ret) ret = (struct GGGGC_Pool *) allocPool(mustSucceed);
+        if (!ret) return NULL;
+        ret->hugetlb = hugetlb;
+
+        ggc_mutex_lock_raw(&hugePageCountsLock);
+        if (hugetlb)
+            hugePageCounts.hugetlb++;
+        else if (huge)
+            hugePageCounts.advised++;
+        else
+            hugePageCounts.normal++;
+        ggc_mutex_unlock(&hugePageCountsLock);
+    }
 
     /* set it up */
     ret->next = NULL;
-    ret->free = ret->start;
+    ret->free = ret->zeroed = ret->start;
     ret->end = (ggc_size_t *) ((unsigned char *) ret + GGGGC_POOL_BYTES);
+    ret->large = 0;
 
     return ret;
 }
 
+void ggggc_getHugePageCounts(struct GGGGC_HugePageCounts *counts)
+{
+    ggc_mutex_lock_raw(&hugePageCountsLock);
+    *counts = hugePageCounts;
+    ggc_mutex_unlock(&hugePageCountsLock);
+}
+
 /* allocate and initialize a pool based on a prototype */
 struct GGGGC_Pool *ggggc_newPoolProto(struct GGGGC_Pool *proto)
 {
     return ggggc_newPool(0);
 }
 
-/* heuristically expand a pool list if it has too many survivors
- * poolList: Pool list to expand
- * newPool: Function to allocate a new pool based on a prototype pool
- * ratio: As a power of two, portion of pool that should be survivors */
-void ggggc_expandPoolList(struct GGGGC_Pool *poolList,
-                          struct GGGGC_Pool *(*newPool)(struct GGGGC_Pool *),
-                          int ratio)
+/* large objects are mapped on their own, where the OS supports it */
+#if defined(MAP_ANON) && !defined(GGGGC_USE_MALLOC)
+#define GGGGC_LARGE_POOLS_MMAP 1
+
+/* the mapping for a large pool holding an object of this many words */
+static ggc_size_t largePoolBytes(ggc_size_t size)
 {
-    struct GGGGC_Pool *pool = poolList;
-    ggc_size_t space, survivors, poolCt;
+    static ggc_size_t pageSize;
+    ggc_size_t bytes = (ggc_size_t) ((struct GGGGC_Pool *) 0)->start + size * sizeof(ggc_size_t);
+    if (!pageSize) pageSize = sysconf(_SC_PAGESIZE);
+    return (bytes + pageSize - 1) & ~(pageSize - 1);
+}
+#endif
 
-    if (!pool) return;
+/* allocate a pool of its own for a large object, or return NULL if that's not
+ * possible. Only the object's own pages (and the header's) are mapped */
+struct GGGGC_Pool *ggggc_newLargePool(ggc_size_t size)
+{
+#ifdef GGGGC_LARGE_POOLS_MMAP
+    unsigned char *space, *aspace;
+    struct GGGGC_Pool *ret;
+    ggc_size_t bytes = largePoolBytes(size);
+
+    /* it must be aligned like any pool, so that GGGGC_POOL_OF finds it */
+    space = (unsigned char *) mmap(NULL, bytes + GGGGC_POOL_BYTES, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    if (space == MAP_FAILED)
+        return NULL;
+    ret = GGGGC_POOL_OF(space + GGGGC_POOL_BYTES - 1);
+    aspace = (unsigned char *) ret;
+    if (aspace > space)
+        munmap(space, aspace - space);
+    munmap(aspace + bytes, space + GGGGC_POOL_BYTES - aspace);
+
+    /* the mapping is zeroed, so only the rest needs setting */
+    ret->free = ret->end = ret->start + size;
+    ret->large = 1;
+    return ret;
+
+#else
+    return NULL;
 
-    /* first figure out how much space was used */
-    space = 0;
-    survivors = 0;
-    poolCt = 0;
-    while (1) {
-        space += pool->end - pool->start;
-        survivors += pool->survivors;
-        pool->survivors = 0;
-        poolCt++;
-        if (!pool->next) break;
-        pool = pool->next;
+#endif
+}
+
+/* free a large object's pool */
+void ggggc_freeLargePool(struct GGGGC_Pool *pool)
+{
+#ifdef GGGGC_LARGE_POOLS_MMAP
+    munmap(pool, largePoolBytes(pool->end - pool->start));
+#endif
+}
+
+/* the heap policy, read from the environment when first needed */
+static ggc_mutex_t policyLock = GGC_MUTEX_INITIALIZER;
+static struct GGGGC_HeapPolicy policy;
+static int policyRead;
+
+/* an environment variable as a number, with an optional K, M or G suffix */
+static ggc_size_t envSize(const char *name, ggc_size_t def)
+{
+    const char *val = getenv(name);
+    char *end;
+    ggc_size_t ret;
+
+    if (!val || !*val) return def;
+    ret = strtoul(val, &end, 10);
+    switch (*end) {
+        case 'g': case 'G': ret <<= 10; /* fall through */
+        case 'm': case 'M': ret <<= 10; /* fall through */
+        case 'k': case 'K': ret <<= 10;
     }
+    return ret;
+}
+
+/* read the policy from the environment if it hasn't been already. Call with
+ * policyLock held */
+static void readPolicy()
+{
+    if (policyRead) return;
+    policy.maxHeap = envSize("GGGGC_MAX_HEAP", 0);
+    policy.minFree = envSize("GGGGC_MIN_FREE", 50);
+    policy.maxFree = envSize("GGGGC_MAX_FREE", 90);
+    policy.gcTime = envSize("GGGGC_GC_TIME", 0);
+    policy.hugePages = envSize("GGGGC_HUGE_PAGES", 0);
+    policy.sizer = NULL;
+    policyRead = 1;
+}
+
+void ggggc_getHeapPolicy(struct GGGGC_HeapPolicy *ret)
+{
+    ggc_mutex_lock_raw(&policyLock);
+    readPolicy();
+    *ret = policy;
+    ggc_mutex_unlock(&policyLock);
+}
+
+void ggggc_setHeapPolicy(const struct GGGGC_HeapPolicy *set)
+{
+    ggc_mutex_lock_raw(&policyLock);
+    policy = *set;
+    policyRead = 1;
+    ggc_mutex_unlock(&policyLock);
+}
+
+/* the policy's decision, when it has no sizer of its own */
+static ggc_size_t defaultHeapTarget(struct GGGGC_HeapPolicy *pol, struct GGGGC_HeapStatus *status)
+{
+    ggc_size_t pools = status->pools, target = pools, need, maxPools;
+    double live = status->liveBytes;
+    double poolSpace = (double) status->spaceBytes / pools;
+    double usedLimit = status->spaceBytes * (100 - pol->minFree) / 100.0;
+
+    if (status->mustGrow || live > usedLimit ||
+        (pol->gcTime && status->gcPercent > pol->gcTime)) {
+        /* grow geometrically, and at least enough to have minFree free */
+        target = pools * 2;
+        need = (ggc_size_t) (live * 100 / (100 - pol->minFree) / poolSpace) + 1;
+        if (need > target) target = need;
+
+    } else if (status->trim) {
+        /* shrink as far as minFree allows */
+        target = (ggc_size_t) (live * 100 / (100 - pol->minFree) / poolSpace) + 1;
+
+    } else if (pol->maxFree > pol->minFree &&
+               live < status->spaceBytes * (100 - pol->maxFree) / 100.0) {
+        /* shrink to have maxFree free */
+        target = (ggc_size_t) (live * 100 / (100 - pol->maxFree) / poolSpace) + 1;
 
-    /* now decide if it's too much */
-    if ((survivors<<ratio) > space) {
-        /* allocate more */
-        ggc_size_t i;
-        for (i = 0; i < poolCt; i++) {
-            pool->next = newPool(poolList);
-            pool = pool->next;
-            if (!pool) break;
-        }
     }
+
+    if (pol->maxHeap) {
+        maxPools = pol->maxHeap / status->poolBytes;
+        if (maxPools < 1) maxPools = 1;
+        if (target > maxPools) target = (pools > maxPools) ? pools : maxPools;
+    }
+
+    return target;
+}
+
+ggc_size_t ggggc_heapTarget(struct GGGGC_HeapStatus *status)
+{
+    struct GGGGC_HeapPolicy pol;
+    ggc_size_t target;
+
+    ggggc_getHeapPolicy(&pol);
+    if (pol.minFree > 99) pol.minFree = 99;
+    if (pol.maxFree > 99) pol.maxFree = 99;
+    status->gcPercent = ggggc_gcFraction() * 100;
+
+    if (pol.sizer)
+        target = pol.sizer(status);
+    else
+        target = defaultHeapTarget(&pol, status);
+
+    /* a failed allocation needs more space, whatever the policy says */
+    if (status->mustGrow && target <= status->pools)
+        target = status->pools + 1;
+    if (target < 1) target = 1;
+    return target;
 }
 
-/* free a generation (used when a thread exits) */
+/* free a list of pools (used when a thread exits, or the heap shrinks). Their
+ * memory goes back to the OS until they're reused */
 void ggggc_freeGeneration(struct GGGGC_Pool *pool)
 {
+    struct GGGGC_Pool *cur;
+
     if (!pool) return;
+    for (cur = pool; cur; cur = cur->next) {
+        ggggc_decommit(cur->start, (unsigned char *) cur + GGGGC_POOL_BYTES);
+    }
+
     ggc_mutex_lock_raw(&freePoolsLock);
     if (freePoolsHead) {
         freePoolsTail->next = pool;
@@ -238,6 +432,7 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorDescriptor(ggc_size_t size)
     else
         ret->header.descriptor__ptr = ret;
     ret->size = size;
+    ret->pointerArray = 0;
     ret->pointers[0] = GGGGC_DESCRIPTOR_DESCRIPTION;
 
     /* put it in the list */
@@ -279,6 +474,7 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorL(ggc_size_t size, const ggc_si
     ret = (struct GGGGC_Descriptor *) ggggc_mallocRaw(&dd, dd->size);
     ret->header.descriptor__ptr = dd;
     ret->size = size;
+    ret->pointerArray = 0;
 
     /* and set it up */
     if (pointers) {
@@ -291,12 +487,37 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorL(ggc_size_t size, const ggc_si
     return ret;
 }
 
+/* cache a newly-allocated array descriptor, or return the one already cached
+ * if another thread beat us to it */
+static struct GGGGC_Descriptor *cacheArrayDescriptor(int kind, ggc_size_t size, struct GGGGC_Descriptor *descriptor)
+{
+    ggc_mutex_lock_raw(&ggggc_arrayDescriptorsLock);
+    if (ggggc_arrayDescriptors[kind][size]) {
+        ggc_mutex_unlock(&ggggc_arrayDescriptorsLock);
+        return ggggc_arrayDescriptors[kind][size];
+    }
+    ggggc_arrayDescriptors[kind][size] = descriptor;
+    ggc_mutex_unlock(&ggggc_arrayDescriptorsLock);
+
+    /* make the cache entry a root. Globalizing may collect, so the descriptor
+     * is only where the (now rooted) cache entry says */
+    GGC_PUSH_1(ggggc_arrayDescriptors[kind][size]);
+    GGC_GLOBALIZE();
+
+    return ggggc_arrayDescriptors[kind][size];
+}
+
 /* descriptor allocator for pointer arrays */
 struct GGGGC_Descriptor *ggggc_allocateDescriptorPA(ggc_size_t size)
 {
+    struct GGGGC_Descriptor *ret;
     ggc_size_t *pointers;
     ggc_size_t dPWords, i;
 
+    /* check if we already have a descriptor */
+    if (size < GGGGC_ARRAY_DESCRIPTOR_CACHE && ggggc_arrayDescriptors[GGGGC_ARRAY_DESCRIPTOR_PA][size])
+        return ggggc_arrayDescriptors[GGGGC_ARRAY_DESCRIPTOR_PA][size];
+
     /* fill our pointer-words with 1s */
     dPWords = GGGGC_DESCRIPTOR_WORDS_REQ(size);
     pointers = (ggc_size_t *) alloca(sizeof(ggc_size_t) * dPWords);
@@ -308,15 +529,29 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptorPA(ggc_size_t size)
         ((ggc_size_t)1<<((((ggc_size_t) (void *) &((GGC_voidpArray) 0)->length)/sizeof(ggc_size_t))))
         );
 
-    /* and allocate */
-    return ggggc_allocateDescriptorL(size, pointers);
+    /* and allocate, noting that the elements are all pointers so that the
+     * collector can skip the bitmap */
+    ret = ggggc_allocateDescriptorL(size, pointers);
+    ret->pointerArray = ((ggc_size_t) (void *) &((GGC_voidpArray) 0)->length)/sizeof(ggc_size_t) + 1;
+    if (size < GGGGC_ARRAY_DESCRIPTOR_CACHE)
+        ret = cacheArrayDescriptor(GGGGC_ARRAY_DESCRIPTOR_PA, size, ret);
+    return ret;
 }
 
 /* descriptor allocator for data arrays */
 struct GGGGC_Descriptor *ggggc_allocateDescriptorDA(ggc_size_t size)
 {
+    struct GGGGC_Descriptor *ret;
+
+    /* check if we already have a descriptor */
+    if (size < GGGGC_ARRAY_DESCRIPTOR_CACHE && ggggc_arrayDescriptors[GGGGC_ARRAY_DESCRIPTOR_DA][size])
+        return ggggc_arrayDescriptors[GGGGC_ARRAY_DESCRIPTOR_DA][size];
+
     /* and allocate */
-    return ggggc_allocateDescriptorL(size, NULL);
+    ret = ggggc_allocateDescriptorL(size, NULL);
+    if (size < GGGGC_ARRAY_DESCRIPTOR_CACHE)
+        ret = cacheArrayDescriptor(GGGGC_ARRAY_DESCRIPTOR_DA, size, ret);
+    return ret;
 }
 
 /* allocate a descriptor from a descriptor slot */
@@ -18,10 +18,13 @@
 
 #include "ggggc/gc.h"
 
+#include <errno.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "ggggc-internals.h"
 
@@ -32,277 +35,650 @@ extern "C" {
 #define TRUE 1
 #define FALSE 0
 
-/* list of pointers to search and associated macros */
-#define TOSEARCH_SZ 1024
-struct ToSearch {
-    struct ToSearch *prev, *next;
+/* forwarded objects have their new location, tagged, in place of their descriptor */
+#define FORWARD(obj, to) do { \
+    struct GGGGC_Header *hobj = (obj); \
+    hobj->descriptor__ptr = (struct GGGGC_Descriptor *) \
+        ((ggc_size_t) (to) | (ggc_size_t) 1l); \
+} while (0)
+
+#define UNFORWARD_PTR(type, ptr) \
+    ((type *) ((ggc_size_t) (ptr) & (ggc_size_t) ~1l))
+
+#define IS_FORWARDED_PTR(ptr) ((ggc_size_t) (ptr) & 1l)
+
+/* is this object forwarded? */
+#define IS_FORWARDED(obj) IS_FORWARDED_PTR((obj)->descriptor__ptr)
+
+/* the object a forwarded object was moved to */
+#define FORWARDED_OBJECT(obj) \
+    (UNFORWARD_PTR(struct GGGGC_Header, (obj)->descriptor__ptr))
+
+/* the mutator may store tagged non-pointers (e.g. small ints) in pointer
+ * slots, which are never objects */
+#define IS_TAGGED(ptr) ((ggc_size_t) (ptr) & (sizeof(ggc_size_t)-1))
+
+/* copying in parallel needs atomics and somewhere to run the workers */
+#if defined(__GNUC__) && !defined(GGGGC_NO_GNUC_FEATURES) && defined(GGGGC_THREADS_POSIX)
+#define PARALLEL_GC 1
+#define MAX_GC_WORKERS 64
+#else
+#define MAX_GC_WORKERS 1
+#endif
+
+/* each worker copies into a to-space buffer of its own, and scans what it's
+ * copied there Cheney-style, with the buffer's scan pointer as its work
+ * queue. Runs of copied objects it can't scan that way (the rest of a buffer
+ * it's moved on from, objects copied outside of its buffer, and large
+ * objects) are kept in chunks: each worker works from its top chunk alone,
+ * and pushes full chunks onto a locked list from which idle workers may
+ * steal. Idle workers may also be handed what's left to scan of a buffer */
+#define TOSCAN_SZ 1024
+struct ToScanRange {
+    ggc_size_t *start, *end;
+};
+struct ToScan {
+    struct ToScan *next;
     ggc_size_t used;
-    void **buf;
+    struct ToScanRange buf[TOSCAN_SZ];
 };
 
-#define TOSEARCH_INIT() do { \
-    if (toSearchList.buf == NULL) { \
-        toSearchList.buf = (void **) malloc(TOSEARCH_SZ * sizeof(void *)); \
-        if (toSearchList.buf == NULL) { \
-            /* FIXME: handle somehow? */ \
-            perror("malloc"); \
-            abort(); \
-        } \
-    } \
-    toSearch = &toSearchList; \
-    toSearch->used = 0; \
-} while(0)
-#define TOSEARCH_NEXT() do { \
-    if (!toSearch->next) { \
-        struct ToSearch *tsn = (struct ToSearch *) malloc(sizeof(struct ToSearch)); \
-        toSearch->next = tsn; \
-        tsn->prev = toSearch; \
-        tsn->next = NULL; \
-        tsn->buf = (void **) malloc(TOSEARCH_SZ * sizeof(void *)); \
-        if (tsn->buf == NULL) { \
-            perror("malloc"); \
-            abort(); \
-        } \
-    } \
-    toSearch = toSearch->next; \
-    toSearch->used = 0; \
-} while(0)
-#define TOSEARCH_ADD(ptr) do { \
-    if (toSearch->used >= TOSEARCH_SZ) TOSEARCH_NEXT(); \
-    toSearch->buf[toSearch->used++] = (ptr); \
-} while(0)
-#define TOSEARCH_POP(type, into) do { \
-    into = (type) toSearch->buf[--toSearch->used]; \
-    if (toSearch->used == 0 && toSearch->prev) \
-        toSearch = toSearch->prev; \
-} while(0)
-/* macro to add an object's pointers to the tosearch list */
-#define ADD_OBJECT_POINTERS(obj, descriptor) do { \
-    void **objVp = (void **) (obj); \
-    ggc_size_t curWord, curDescription, curDescriptorWord = 0; \
-    if (descriptor->pointers[0] & 1l) { \
-        /* it has pointers */ \
-        curDescription = descriptor->pointers[0] >> 1; \
-        for (curWord = 1; curWord < descriptor->size; curWord++) { \
-            if (curWord % GGGGC_BITS_PER_WORD == 0) \
-                curDescription = descriptor->pointers[++curDescriptorWord]; \
-            if (curDescription & 1l) \
-                /* it's a pointer */ \
-                TOSEARCH_ADD(&objVp[curWord]); \
-            curDescription >>= 1; \
-        } \
-    } \
-    TOSEARCH_ADD(&objVp[0]); \
-} while(0)
+/* the to-space buffers workers copy into, in words */
+#define COPY_BUFFER_SIZE 4096
 
+struct GCWorker {
+    /* the chunk being worked on, private to this worker */
+    struct ToScan *toScan;
 
-/* mark an object */
-#define MARK(obj) do { \
-    struct GGGGC_Header *hobj = (obj); \
-    hobj->descriptor__ptr = (struct GGGGC_Descriptor *) \
-        ((ggc_size_t) hobj->descriptor__ptr | (ggc_size_t) 1l); \
-} while (0)
+    /* full chunks, available for stealing */
+    ggc_mutex_t lock;
+    struct ToScan *full;
 
-/* unmark a pointer */
-#define UNMARK_PTR(type, ptr) \
-    ((type *) ((ggc_size_t) (ptr) & (ggc_size_t) ~1l))
+    /* empty chunks, private */
+    struct ToScan *spare;
 
-/* get an object's descriptor, through markers */
-#define MARKED_DESCRIPTOR(obj) \
-    (UNMARK_PTR(struct GGGGC_Descriptor, (obj)->descriptor__ptr))
+    /* this worker's to-space buffer: copied and scanned up to scan, copied up
+     * to copyFree, and free up to copyEnd */
+    ggc_size_t *scan, *copyFree, *copyEnd;
 
-/* unmark an object */
-#define UNMARK(obj) do { \
-    struct GGGGC_Header *hobj = (obj); \
-    hobj->descriptor__ptr = UNMARK_PTR(struct GGGGC_Descriptor, hobj->descriptor__ptr); \
-} while (0)
+    /* words copied this collection */
+    ggc_size_t survivors;
+};
 
-/* is this pointer marked? */
-#define IS_MARKED_PTR(ptr) ((ggc_size_t) (ptr) & 1l)
+static struct GCWorker gcWorkers[MAX_GC_WORKERS];
+static ggc_size_t gcWorkerCount;
 
-/* is this object marked? */
-#define IS_MARKED(obj) IS_MARKED_PTR((obj)->descriptor__ptr)
+/* is copying running in parallel (and so needs atomic forwarding)? */
+static int gcParallel;
 
+/* how many workers are copying (or trying to steal), and how many are idle */
+static volatile ggc_size_t gcBusy, gcIdle;
 
-/* unforward a pointer */
-#define FORWARD(obj) do { \
-    struct GGGGC_Header *hobj = (obj); \
-    hobj->descriptor__ptr = (struct GGGGC_Descriptor *) \
-        ((ggc_size_t) hobj->descriptor__ptr | (ggc_size_t) 2); \
-} while (0)
+/* the semispaces during a collection, and the to-space pool buffers are
+ * being taken from, protected by toLock */
+static struct GGGGC_Pool *fromSpace, *toSpace, *toPool;
+static ggc_mutex_t toLock = GGC_MUTEX_INITIALIZER;
 
-#define UNFORWARD_PTR(type, ptr) \
-    ((type *) ((ggc_size_t) (ptr) & (ggc_size_t) ~2l))
+/* get an empty chunk for a worker, or NULL if there's no memory for one */
+static struct ToScan *newChunk(struct GCWorker *w)
+{
+    struct ToScan *ret = w->spare;
+    if (ret) {
+        w->spare = ret->next;
+    } else {
+        ret = (struct ToScan *) malloc(sizeof(struct ToScan));
+        if (ret == NULL) return NULL;
+    }
+    ret->next = NULL;
+    ret->used = 0;
+    return ret;
+}
+
+/* make a chunk available for stealing */
+static void shareChunk(struct GCWorker *w, struct ToScan *chunk)
+{
+    ggc_mutex_lock_raw(&w->lock);
+    chunk->next = w->full;
+    w->full = chunk;
+    ggc_mutex_unlock(&w->lock);
+}
+
+/* replace a worker's empty current chunk with a full one */
+static void takeChunk(struct GCWorker *w, struct ToScan *chunk)
+{
+    w->toScan->next = w->spare;
+    w->spare = w->toScan;
+    w->toScan = chunk;
+}
 
-/* get an object's descriptor, through markers */
-#define FORWARDED_DESCRIPTOR(obj) \
-    (UNFORWARD_PTR(struct GGGGC_Descriptor, (obj)->descriptor__ptr))
+/* take a full chunk from a worker's list (the worker's own, or a victim's) */
+static struct ToScan *popChunk(struct GCWorker *from)
+{
+    struct ToScan *ret;
+    if (!from->full) return NULL;
+    ggc_mutex_lock_raw(&from->lock);
+    if ((ret = from->full))
+        from->full = ret->next;
+    ggc_mutex_unlock(&from->lock);
+    return ret;
+}
 
-#define IS_FORWARDED_PTR(ptr) ((ggc_size_t) (ptr) & 2l)
+/* give the older half of our current chunk to idle workers */
+static void splitChunk(struct GCWorker *w)
+{
+    struct ToScan *chunk, *cur = w->toScan;
+    ggc_size_t half = cur->used / 2;
+    if (!(chunk = newChunk(w))) return;
+    memcpy(chunk->buf, cur->buf, half * sizeof(struct ToScanRange));
+    memmove(cur->buf, cur->buf + half, (cur->used - half) * sizeof(struct ToScanRange));
+    chunk->used = half;
+    cur->used -= half;
+    shareChunk(w, chunk);
+}
 
-/* is this object marked? */
-#define IS_FORWARDED(obj) IS_FORWARDED_PTR((obj)->descriptor__ptr)
+static void scanRange(struct GCWorker *w, ggc_size_t *start, ggc_size_t *end);
 
-static struct ToSearch toSearchList;
+/* remember a run of copied objects to scan later. If there's no memory for a
+ * new chunk, scan it now instead */
+static void pushRange(struct GCWorker *w, ggc_size_t *start, ggc_size_t *end)
+{
+    struct ToScan *chunk;
+    if (w->toScan->used >= TOSCAN_SZ) {
+        if (!(chunk = newChunk(w))) {
+            scanRange(w, start, end);
+            return;
+        }
+        shareChunk(w, w->toScan);
+        w->toScan = chunk;
+    }
+    w->toScan->buf[w->toScan->used].start = start;
+    w->toScan->buf[w->toScan->used].end = end;
+    w->toScan->used++;
+}
 
+/* if a worker's buffer is the last thing taken from its pool, give back what
+ * it hasn't used. Must hold toLock, or be the only one copying */
+static int returnCopyBuffer(struct GCWorker *w)
+{
+    struct GGGGC_Pool *pool;
+    if (w->copyFree >= w->copyEnd) return FALSE;
+    pool = GGGGC_POOL_OF(w->copyFree);
+    if (pool->free != w->copyEnd) return FALSE;
+    pool->free = w->copyFree;
+    w->copyEnd = w->copyFree;
+    return TRUE;
+}
 
-void ggggc_processAndForward()
+/* take to-space from the shared pools: a whole buffer, unless the object is
+ * large, in which case just enough for it. Our old buffer's tail is given
+ * back if nobody's taken space since, so that (always, with one worker) the
+ * new space just extends the buffer. Otherwise, whichever of the old buffer
+ * and what the object doesn't use of the new space is bigger becomes our
+ * buffer, and if it's the new space, the rest of the old one is left to scan
+ * later. An object that isn't copied into our buffer must be pushed for
+ * scanning by the caller */
+static ggc_size_t *refillCopyBuffer(struct GCWorker *w, ggc_size_t size)
 {
     struct GGGGC_Pool *poolCur;
-    struct GGGGC_Header *header;
-    ggc_size_t *cur, tempSize;
+    ggc_size_t *ret, want, got;
+
+    want = (size <= COPY_BUFFER_SIZE / 2) ? COPY_BUFFER_SIZE : size;
+
+    ggc_mutex_lock_raw(&toLock);
+    returnCopyBuffer(w);
+    while (toPool->end - toPool->free < size) {
+        if (!toPool->next) {
+            /* ran out of to-space, so grow both semispaces */
+            toPool->next = ggggc_newPool(1);
+            for (poolCur = fromSpace; poolCur->next; poolCur = poolCur->next);
+            poolCur->next = ggggc_newPool(1);
+        }
+        toPool = toPool->next;
+    }
+    got = toPool->end - toPool->free;
+    if (got > want) got = want;
+    ret = toPool->free;
+    toPool->free += got;
+    ggc_mutex_unlock(&toLock);
+
+    if (ret == w->copyFree) {
+        w->copyFree = ret + size;
+        w->copyEnd = ret + got;
+
+    } else if (got - size > (ggc_size_t) (w->copyEnd - w->copyFree)) {
+        if (w->scan < w->copyFree)
+            pushRange(w, w->scan, w->copyFree);
+        w->scan = ret;
+        w->copyFree = ret + size;
+        w->copyEnd = ret + got;
 
-    if (poolOrder == 0) {
-        poolCur = ggggc_fromPool;
+    }
+    return ret;
+}
+
+/* give back the space of an object we lost the race to copy, if nothing's
+ * been taken since. Otherwise it's left as a gap in to-space */
+static void returnCopy(struct GCWorker *w, struct GGGGC_Header *nobj, ggc_size_t size)
+{
+    struct GGGGC_Pool *pool;
+
+    if ((ggc_size_t *) nobj + size == w->copyFree) {
+        w->copyFree = (ggc_size_t *) nobj;
+        return;
+    }
+
+    pool = GGGGC_POOL_OF(nobj);
+    ggc_mutex_lock_raw(&toLock);
+    if (pool->free == (ggc_size_t *) nobj + size)
+        pool->free = (ggc_size_t *) nobj;
+    ggc_mutex_unlock(&toLock);
+}
+
+/* copy an object to to-space, returning its new location */
+static struct GGGGC_Header *copyObject(struct GCWorker *w, struct GGGGC_Header *obj)
+{
+    struct GGGGC_Descriptor *descriptor = obj->descriptor__ptr;
+    struct GGGGC_Pool *pool = GGGGC_POOL_OF(obj);
+    struct GGGGC_Header *nobj;
+    ggc_size_t size;
+
+    /* another worker may have beaten us to it */
+    if (IS_FORWARDED_PTR(descriptor))
+        return UNFORWARD_PTR(struct GGGGC_Header, descriptor);
+
+    /* the descriptor may already have been forwarded, but its size is intact */
+    size = descriptor->size;
+
+    /* large objects stay where they are, and just need scanning once */
+    if (pool->large) {
+#ifdef PARALLEL_GC
+        if (gcParallel) {
+            if (!__sync_bool_compare_and_swap(&pool->survivors, 0, 1))
+                return obj;
+        } else
+#endif
+        {
+            if (pool->survivors) return obj;
+            pool->survivors = 1;
+        }
+        pushRange(w, (ggc_size_t *) obj, (ggc_size_t *) obj + size);
+        return obj;
+    }
+
+    if ((ggc_size_t) (w->copyEnd - w->copyFree) >= size) {
+        nobj = (struct GGGGC_Header *) w->copyFree;
+        w->copyFree += size;
     } else {
-        poolCur = ggggc_toPool;
+        nobj = (struct GGGGC_Header *) refillCopyBuffer(w, size);
     }
+    memcpy(nobj, obj, size * sizeof(ggc_size_t));
+    nobj->descriptor__ptr = descriptor;
+
+#ifdef PARALLEL_GC
+    if (gcParallel) {
+        if (!__sync_bool_compare_and_swap(&obj->descriptor__ptr, descriptor,
+                (struct GGGGC_Descriptor *) ((ggc_size_t) nobj | (ggc_size_t) 1l))) {
+            /* lost the race, so give the space back if we can */
+            returnCopy(w, nobj, size);
+            return FORWARDED_OBJECT(obj);
+        }
+    } else
+#endif
+    FORWARD(obj, nobj);
+
+    /* our buffer's scan pointer will reach it, unless it's outside */
+    if ((ggc_size_t *) nobj + size != w->copyFree)
+        pushRange(w, (ggc_size_t *) nobj, (ggc_size_t *) nobj + size);
+
+    w->survivors += size;
+    return nobj;
+}
+
+/* update a slot to point into to-space, copying its object on first visit */
+#define FORWARD_SLOT(w, slot) do { \
+    void **fslot = (slot); \
+    struct GGGGC_Header *fobj = (struct GGGGC_Header *) *fslot; \
+    if (fobj && !IS_TAGGED(fobj)) { \
+        if (IS_FORWARDED(fobj)) \
+            *fslot = FORWARDED_OBJECT(fobj); \
+        else \
+            *fslot = copyObject((w), fobj); \
+    } \
+} while (0)
+
+/* forward the pointers of a copied object, returning its size */
+static ggc_size_t scanObject(struct GCWorker *w, struct GGGGC_Header *obj)
+{
+    struct GGGGC_Descriptor *descriptor;
+    void **objVp = (void **) obj;
+    ggc_size_t curWord;
+
+    /* the descriptor first, so that we read the to-space copy */
+    FORWARD_SLOT(w, &objVp[0]);
+    descriptor = obj->descriptor__ptr;
+
+    GGGGC_FOR_EACH_POINTER(descriptor, curWord, FORWARD_SLOT(w, &objVp[curWord]));
+    return descriptor->size;
+}
+
+/* scan a run of copied objects */
+static void scanRange(struct GCWorker *w, ggc_size_t *start, ggc_size_t *end)
+{
+    while (start < end)
+        start += scanObject(w, (struct GGGGC_Header *) start);
+}
+
+/* scan what we've copied into our buffer. The scan pointer moves past each
+ * object before it's scanned, so that if the buffer's replaced meanwhile,
+ * just what's left is pushed */
+static void scanBuffer(struct GCWorker *w)
+{
+    struct GGGGC_Header *obj;
+    struct ToScan *chunk;
+
+    while (w->scan < w->copyFree) {
+        obj = (struct GGGGC_Header *) w->scan;
+        w->scan += obj->descriptor__ptr->size;
+        scanObject(w, obj);
+
+        /* if others are waiting for work, hand them the rest */
+        if (gcIdle && !w->full && w->scan < w->copyFree &&
+            (chunk = newChunk(w))) {
+            chunk->buf[0].start = w->scan;
+            chunk->buf[0].end = w->copyFree;
+            chunk->used = 1;
+            w->scan = w->copyFree;
+            shareChunk(w, chunk);
+        }
+    }
+}
+
+/* look for work in other workers' lists, returning false once there's none
+ * left anywhere */
+static int findWork(struct GCWorker *w)
+{
+#ifdef PARALLEL_GC
+    struct ToScan *chunk;
+    ggc_size_t i;
 
-    while (poolCur) {
-        for (cur = poolCur->start; cur < poolCur->free; cur += tempSize) {
-            header = (struct GGGGC_Header *) cur;
-            header = UNMARK_PTR(struct GGGGC_Header, header);
-            if (IS_MARKED(header)) {
-                UNMARK(header);
-                //printf("header after unmark: %lu \n", header);
-                tempSize = header->descriptor__ptr->size;
-                //printf("tempSize after unmark: %lu \n", tempSize);
-                memcpy(poolCur->poolBuddy->free, header, tempSize * sizeof(ggc_size_t));
-                header->descriptor__ptr = (struct GGGGC_Descriptor *) poolCur->poolBuddy->free;
-                poolCur->poolBuddy->free += tempSize;
-                FORWARD(header);
-            } else {
-                tempSize = header->descriptor__ptr->size;
-                //printf("tempSize: %lu \n", tempSize);
+    if (gcWorkerCount == 1) return FALSE;
+
+    __sync_fetch_and_sub(&gcBusy, 1);
+    __sync_fetch_and_add(&gcIdle, 1);
+
+    /* only busy workers make work, so once none are busy, we're done */
+    while (gcBusy) {
+        for (i = 1; i < gcWorkerCount; i++) {
+            struct GCWorker *victim = &gcWorkers[(w - gcWorkers + i) % gcWorkerCount];
+            if (!victim->full) continue;
+            __sync_fetch_and_add(&gcBusy, 1);
+            if ((chunk = popChunk(victim))) {
+                __sync_fetch_and_sub(&gcIdle, 1);
+                takeChunk(w, chunk);
+                return TRUE;
             }
+            __sync_fetch_and_sub(&gcBusy, 1);
         }
-        poolCur = poolCur->next;
+        sched_yield();
     }
+#endif
 
-    ggggc_updateRefs();
+    return FALSE;
 }
 
-void ggggc_updateRefs()
+/* forward this worker's share of the roots: every gcWorkerCount'th frame of
+ * the pointer stacks, and a slice of each JIT pointer stack */
+static void forwardRoots(struct GCWorker *w)
 {
-    struct GGGGC_Pool *poolCur, *tempPool;
     struct GGGGC_PointerStackList *pslCur;
     struct GGGGC_JITPointerStackList *jpslCur;
     struct GGGGC_PointerStack *psCur;
-    struct GGGGC_Header *header, *tmpHeader;
-    struct GGGGC_Descriptor *descriptor, *tempDescriptor;
-    void **jpsCur;
-    void **objVp;
-    ggc_size_t i, *cur, tempSize;
-    ggc_size_t curWord, curDescription, curDescriptorWord;
-
-    if (poolOrder == 0) {
-        poolOrder = 1;
-        ggggc_pool = poolCur = ggggc_toPool;
-    } else {
-        poolOrder = 0;
-        ggggc_pool = poolCur = ggggc_fromPool;
-    }
+    void **jpsCur, **jpsEnd;
+    ggc_size_t id = w - gcWorkers, frame = 0, i, n;
 
     for (pslCur = ggggc_rootPointerStackList; pslCur; pslCur = pslCur->next) {
         for (psCur = pslCur->pointerStack; psCur; psCur = psCur->next) {
-            ggc_size_t ***pointers = (ggc_size_t ***) psCur->pointers;
+            if (frame++ % gcWorkerCount != id) continue;
             for (i = 0; i < psCur->size; i++) {
-                if (*pointers[i]) {
-                    header = (struct GGGGC_Header *) *pointers[i];
-                    if (IS_FORWARDED(header)) {
-                        *pointers[i] = UNFORWARD_PTR(struct GGGGC_Header, (header->descriptor__ptr));
-                    }
-                }
+                FORWARD_SLOT(w, (void **) psCur->pointers[i]);
             }
         }
     }
-
     for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
-        for (jpsCur = jpslCur->cur; *jpsCur && jpsCur < jpslCur->top; jpsCur++) {
-            header = (struct GGGGC_Header *) *jpsCur;
-            if (IS_FORWARDED(header)) {
-                *jpsCur = UNFORWARD_PTR(struct GGGGC_Header, (header->descriptor__ptr));
-            }
+        n = jpslCur->top - jpslCur->cur;
+        jpsCur = jpslCur->cur + n * id / gcWorkerCount;
+        jpsEnd = jpslCur->cur + n * (id + 1) / gcWorkerCount;
+        for (; jpsCur < jpsEnd; jpsCur++) {
+            FORWARD_SLOT(w, jpsCur);
         }
     }
+}
 
-    while (poolCur) {
-        for (cur = poolCur->start; cur < poolCur->free; cur += tempSize) {
-            header = (struct GGGGC_Header *) cur;
-            objVp = (void **) (header);
-            if (IS_FORWARDED(((struct GGGGC_Header *) header->descriptor__ptr))) {
-                /* Since after the casting, header->descriptor__ptr is forwarded, which means it must be pointing to another header */
-                tmpHeader = (struct GGGGC_Header *) header->descriptor__ptr;
-                descriptor = tmpHeader->descriptor__ptr;
-                header->descriptor__ptr = UNFORWARD_PTR(struct GGGGC_Descriptor, descriptor);
+/* copy everything reachable from the roots, each worker starting from its
+ * share of them */
+static void copyLoop(struct GCWorker *w)
+{
+    struct ToScanRange range;
+    struct ToScan *chunk;
+
+    forwardRoots(w);
+    if (w == gcWorkers)
+        ggggc_collectionPhase(GGGGC_PHASE_COPY);
+
+    do {
+        while (1) {
+            scanBuffer(w);
+            if (!w->toScan->used) {
+                if (!(chunk = popChunk(w))) break;
+                takeChunk(w, chunk);
             }
+            range = w->toScan->buf[--w->toScan->used];
+            scanRange(w, range.start, range.end);
+
+            /* if others are waiting for work, share some */
+            if (gcIdle && !w->full && w->toScan->used >= 2)
+                splitChunk(w);
+        }
+    } while (findWork(w));
+}
+
+#ifdef PARALLEL_GC
+/* helper workers wait here for each collection, then copy */
+static ggc_sem_t workerStart;
+static ggc_barrier_t workerDone;
+
+static void *gcWorkerThread(void *arg)
+{
+    struct GCWorker *w = (struct GCWorker *) arg;
+    while (1) {
+        ggc_sem_wait_raw(&workerStart);
+        copyLoop(w);
+        ggc_barrier_wait_raw(&workerDone);
+    }
+    return NULL;
+}
+#endif
+
+/* set up the workers, the first time we collect. The number of workers is
+ * taken from GGGGC_GC_THREADS, or is the number of processors */
+static void initGCWorkers()
+{
+    ggc_size_t i;
+#ifdef PARALLEL_GC
+    const char *env;
+    long count;
+    pthread_t th;
+
+    if ((env = getenv("GGGGC_GC_THREADS")))
+        count = atol(env);
+    else
+        count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1) count = 1;
+    if (count > MAX_GC_WORKERS) count = MAX_GC_WORKERS;
+    gcWorkerCount = count;
+#else
+    gcWorkerCount = 1;
+#endif
 
-            descriptor = header->descriptor__ptr;
-            curDescriptorWord = 0;
-            if (descriptor->pointers[0] & 1l) {
-                curDescription = descriptor->pointers[0] >> 1;
-                for (curWord = 1; curWord < descriptor->size; curWord++) {
-                    if (curWord % GGGGC_BITS_PER_WORD == 0) {
-                        curDescription = descriptor->pointers[++curDescriptorWord];
-                    }
-                    if (objVp[curWord] && (curDescription & 1l)) {
-                        if (IS_FORWARDED(((struct GGGGC_Header *) objVp[curWord]))) {
-                            /* Same idea, objVp[curWord] is forwarded, then it must be pointing to another header */
-                            tmpHeader = (struct GGGGC_Header *) objVp[curWord];
-                            tempDescriptor = tmpHeader->descriptor__ptr;
-                            objVp[curWord] = UNFORWARD_PTR(struct GGGGC_Header, tempDescriptor);
-                        }
-                    }
-                    curDescription >>= 1;
-                }
+    for (i = 0; i < gcWorkerCount; i++) {
+        ggc_mutex_t lock = GGC_MUTEX_INITIALIZER;
+        gcWorkers[i].lock = lock;
+        if (!(gcWorkers[i].toScan = newChunk(&gcWorkers[i]))) {
+            perror("malloc");
+            abort();
+        }
+    }
+
+#ifdef PARALLEL_GC
+    if (gcWorkerCount > 1) {
+        ggc_sem_init(&workerStart, 0);
+        ggc_barrier_init(&workerDone, gcWorkerCount);
+        for (i = 1; i < gcWorkerCount; i++) {
+            if ((errno = pthread_create(&th, NULL, gcWorkerThread, &gcWorkers[i]))) {
+                perror("pthread_create");
+                abort();
             }
-            tempSize = descriptor->size;
+            pthread_detach(th);
         }
-        poolCur->poolBuddy->free = poolCur->poolBuddy->start;
-        poolCur = poolCur->next;
     }
+#endif
+}
+
+/* large objects each have a pool of their own, outside of the semispaces,
+ * and how much has been allocated in them since the last collection (in
+ * words) */
+static struct GGGGC_Pool *largePools;
+static ggc_size_t largeAllocated;
+
+/* how much of the active semispace the last collection left used (in
+ * words), for counting what's been allocated since */
+static ggc_size_t lastUsed;
+
+/* how the next collection should resize the heap: grow it because an
+ * allocation failed even after collecting, or shrink it as far as the policy
+ * allows for ggggc_trim */
+static int mustGrow, trimHeap;
+
+/* allocate a large object in a pool of its own, or return NULL if we can't */
+static ggc_size_t *allocLarge(struct GGGGC_Descriptor **descriptor, ggc_size_t size)
+{
+    struct GGGGC_Pool *pool;
+    ggc_size_t heapWords = 0;
+
+    /* large objects are only freed by collections, so collect once enough
+     * have been allocated to fill the active semispace */
+    for (pool = (poolOrder == 0) ? ggggc_fromPool : ggggc_toPool; pool; pool = pool->next)
+        heapWords += pool->end - pool->start;
+    if (heapWords && largeAllocated + size > heapWords) {
+        GGC_PUSH_1(*descriptor);
+        ggggc_collect0(0);
+        GGC_POP();
+    }
+
+    if (!(pool = ggggc_newLargePool(size)))
+        return NULL;
+    pool->next = largePools;
+    largePools = pool;
+    largeAllocated += size;
+    return pool->start;
 }
 
-void ggggc_nowExpand(struct GGGGC_Pool *poolList1, struct GGGGC_Pool *poolList2,
-                     struct GGGGC_Pool *(*newPool)(struct GGGGC_Pool *),
-                     int ratio, int expand)
-                     {
-    struct GGGGC_Pool *pool = poolList1;
-    struct GGGGC_Pool *pool2 = poolList2;
-    ggc_size_t space, survivors, poolCt;
+/* free the large objects that weren't reached. Returns the size of those
+ * left, in words */
+static ggc_size_t sweepLarge()
+{
+    struct GGGGC_Pool *pool, **link = &largePools;
+    ggc_size_t survivors = 0;
+
+    while ((pool = *link)) {
+        if (pool->survivors) {
+            pool->survivors = 0;
+            survivors += pool->end - pool->start;
+            link = &pool->next;
+        } else {
+            *link = pool->next;
+            ggggc_freeLargePool(pool);
+        }
+    }
+    largeAllocated = 0;
+    return survivors;
+}
+
+/* allocate a pool for a semispace, which must succeed */
+static struct GGGGC_Pool *newSemispacePool(void)
+{
+    return ggggc_newPool(1);
+}
+
+void ggggc_resizeSemispaces(struct GGGGC_Pool *active, struct GGGGC_Pool *other,
+                            struct GGGGC_Pool *(*newPool)(void),
+                            int expand, int trim)
+{
+    struct GGGGC_Pool *pool = active;
+    struct GGGGC_Pool *pool2 = other;
+    struct GGGGC_HeapStatus status;
+    ggc_size_t survivors, poolCt, usedCt, target;
 
     if (!pool || !pool2) return;
 
-    /* first figure out how much space was used */
-    space = 0;
+    /* first figure out how much space was used. Survivors are copied into
+     * the pools in order, so the used pools are all at the start */
+    status.spaceBytes = 0;
     survivors = 0;
-    poolCt = 0;
+    poolCt = usedCt = 0;
     while (1) {
-        space += pool->end - pool->start;
+        status.spaceBytes += (pool->end - pool->start) * sizeof(ggc_size_t);
         survivors += pool->survivors;
         pool->survivors = 0;
         poolCt++;
+        if (pool->free != pool->start) usedCt = poolCt;
         if (!pool->next) break;
         pool = pool->next;
     }
 
-    /* now decide if it's too much */
-    if ((survivors<<ratio) > space || expand) {
+    /* the other semispace changes in step */
+    while (pool2->next) pool2 = pool2->next;
+
+    status.pools = poolCt;
+    status.poolBytes = 2 * GGGGC_POOL_BYTES;
+    status.liveBytes = survivors * sizeof(ggc_size_t);
+    status.mustGrow = expand;
+    status.trim = trim;
+    target = ggggc_heapTarget(&status);
+
+    if (target > poolCt) {
         /* allocate more */
-        ggc_size_t i;
-        for (i = 0; i < poolCt; i++) {
-            //printf("expanding pool. \n");
-            pool->next = newPool(poolList1);
+        for (; poolCt < target; poolCt++) {
+            pool->next = newPool();
             pool = pool->next;
             if (!pool) break;
-            pool2->next = newPool(poolList2);
+            pool2->next = newPool();
             pool2 = pool2->next;
-            pool->poolBuddy = pool2;
-            pool2->poolBuddy = pool;
         }
+
+    } else if (target < poolCt && usedCt < poolCt) {
+        /* release the empty pools at the end of both */
+        if (target < usedCt) target = usedCt;
+        for (pool = active, pool2 = other; --target; pool = pool->next, pool2 = pool2->next);
+        ggggc_freeGeneration(pool->next);
+        pool->next = NULL;
+        ggggc_freeGeneration(pool2->next);
+        pool2->next = NULL;
+
     }
 }
 
+/* objects must be zeroed, since they go to the untrusted mutator, but rather
+ * than clearing each as it's allocated, clear the free space ahead of them a
+ * chunk at a time, enough for an object of the given size */
+static void zeroAhead(struct GGGGC_Pool *pool, ggc_size_t size)
+{
+    ggc_size_t *to = pool->zeroed + GGGGC_ZERO_CHUNK;
+    if (to < pool->free + size) to = pool->free + size;
+    if (to > pool->end) to = pool->end;
+    memset(pool->zeroed, 0, (to - pool->zeroed) * sizeof(ggc_size_t));
+    pool->zeroed = to;
+}
 
 void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor,  /*descriptor to protect, if applicable*/
                       ggc_size_t size  /*size of object to allocate*/
@@ -311,6 +687,17 @@ void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor,  /*descriptor to pro
     struct GGGGC_Header *ret;
     size_t expand = FALSE;
 
+    GGGGC_SAMPLE_ALLOCATION(descriptor, size);
+
+    /* large objects get a pool of their own, which is already zeroed */
+    if (size >= GGGGC_LARGE_OBJECT &&
+        (ret = (struct GGGGC_Header *) allocLarge(descriptor, size))) {
+#ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
+        ret->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
+#endif
+        return ret;
+    }
+
 retry:
     if (ggggc_pool) {
         pool = ggggc_pool;
@@ -318,23 +705,19 @@ retry:
         poolOrder = 0;
         ggggc_fromPool = ggggc_pool = pool = ggggc_newPool(1);
         ggggc_toPool = ggggc_newPool(1);
-        ggggc_fromPool->poolBuddy = ggggc_toPool;
-        ggggc_toPool->poolBuddy = ggggc_fromPool;
     }
 
     if (pool->end - pool->free >= size) {
          /*good, allocate here*/
+        if ((ggc_size_t) (pool->zeroed - pool->free) < size)
+            zeroAhead(pool, size);
         ret = (struct GGGGC_Header *) pool->free;
         pool->free += size;
 
-        ret->descriptor__ptr = NULL;
 #ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
-         set its canary
+        /* set its canary */
         ret->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
 #endif
-
-         /*and clear the rest (necessary since this goes to the untrusted mutator) */
-        memset(ret + 1, 0, size * sizeof(ggc_size_t) - sizeof(struct GGGGC_Header));
     } else if (pool->next) {
          /*move to the next pool since the current pool don't have enough space to allocate the object*/
         ggggc_pool = pool = pool->next;
@@ -342,15 +725,10 @@ retry:
     } else {
          /*a collection is needed since all the pools don't have enough space to allocate the object
          we also create a new pool in this stage */
+        if (expand) mustGrow = TRUE;
         GGC_PUSH_1(*descriptor);
         ggggc_collect0(0);
         GGC_POP();
-        ggggc_nowExpand(ggggc_fromPool, ggggc_toPool, ggggc_newPool, 1, expand);
-        if (poolOrder == 0) {
-            ggggc_pool = pool = ggggc_fromPool;
-        } else {
-            ggggc_pool = pool = ggggc_toPool;
-        }
         expand = TRUE;
         goto retry;
     }
@@ -366,18 +744,53 @@ void *ggggc_malloc(struct GGGGC_Descriptor *descriptor)
     return ret;
 }
 
+/* give the free memory in both semispaces back to the OS, just after a flip.
+ * Nothing is in from-space until the next collection, or in to-space past the
+ * survivors */
+static void trimSemispaces()
+{
+    struct GGGGC_Pool *poolCur;
+
+    for (poolCur = fromSpace; poolCur; poolCur = poolCur->next)
+        ggggc_decommit(poolCur->start, poolCur->end);
+    for (poolCur = toSpace; poolCur; poolCur = poolCur->next)
+        ggggc_decommit(poolCur->free, poolCur->end);
+}
+
 void ggggc_collect0(unsigned char gen)
 {
-    struct GGGGC_PoolList pool0Node, *plCur;
-    struct GGGGC_Pool *poolCur, *pool1, *pool2;
-    struct GGGGC_PointerStackList pointerStackNode, *pslCur;
-    struct GGGGC_JITPointerStackList jitPointerStackNode, *jpslCur;
-    struct GGGGC_PointerStack *psCur;
-    void **jpsCur;
-    struct ToSearch *toSearch;
-    ggc_size_t i;
+    struct GGGGC_Pool *poolCur;
+    struct GGGGC_PointerStackList pointerStackNode;
+    struct GGGGC_JITPointerStackList jitPointerStackNode;
+    struct GGGGC_CollectionReport report;
+    struct GCWorker *w;
+    ggc_size_t i, used;
+    int returned;
+
+    if (!gcWorkerCount) initGCWorkers();
+    ggggc_collectionStart();
+
+    /* the inactive semispace becomes to-space */
+    if (poolOrder == 0) {
+        fromSpace = ggggc_fromPool;
+        toSpace = ggggc_toPool;
+    } else {
+        fromSpace = ggggc_toPool;
+        toSpace = ggggc_fromPool;
+    }
+
+    /* what was allocated since the last collection is what's been used of
+     * from-space since it ended */
+    used = 0;
+    for (poolCur = fromSpace; poolCur; poolCur = poolCur->next)
+        used += poolCur->free - poolCur->start;
+    report.allocated = used - lastUsed + largeAllocated;
 
-    TOSEARCH_INIT();
+    for (poolCur = toSpace; poolCur; poolCur = poolCur->next) {
+        poolCur->free = poolCur->start;
+        poolCur->survivors = 0;
+    }
+    toPool = toSpace;
 
     /* initialize our roots */
     ggc_mutex_lock_raw(&ggggc_rootsLock);
@@ -390,45 +803,80 @@ void ggggc_collect0(unsigned char gen)
     ggggc_rootJITPointerStackList = &jitPointerStackNode;
     ggc_mutex_unlock(&ggggc_rootsLock);
 
-
-    /* add our roots to the to-search list */
-    for (pslCur = ggggc_rootPointerStackList; pslCur; pslCur = pslCur->next) {
-        for (psCur = pslCur->pointerStack; psCur; psCur = psCur->next) {
-            for (i = 0; i < psCur->size; i++) {
-                TOSEARCH_ADD(psCur->pointers[i]);
-            }
-        }
-    }
-    for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
-        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++) {
-            TOSEARCH_ADD(jpsCur);
-        }
+    /* copy, with the helpers (if any) stealing from worker 0 */
+    for (i = 0; i < gcWorkerCount; i++) {
+        w = &gcWorkers[i];
+        w->scan = w->copyFree = w->copyEnd = NULL;
+        w->survivors = 0;
     }
+    gcBusy = gcWorkerCount;
+    gcIdle = 0;
+    gcParallel = (gcWorkerCount > 1);
+#ifdef PARALLEL_GC
+    for (i = 1; i < gcWorkerCount; i++)
+        ggc_sem_post(&workerStart);
+#endif
+    copyLoop(&gcWorkers[0]);
+#ifdef PARALLEL_GC
+    if (gcWorkerCount > 1)
+        ggc_barrier_wait_raw(&workerDone);
+#endif
 
-    /* mark objects. The same marking phase as in mark and sweep GC. It marks all the objects reachable from the root
-     * so they can be moved to the to-space and the references to be updated after.*/
-    while (toSearch->used) {
-        void **ptr;
-        struct GGGGC_Header *obj;
-
-        TOSEARCH_POP(void **, ptr);
-        obj = (struct GGGGC_Header *) *ptr;
-        if (obj == NULL) continue;
-        obj = UNMARK_PTR(struct GGGGC_Header, obj);
-        /*if the object isn't already marked...*/
-        if (!IS_MARKED(obj)) {
-            struct GGGGC_Descriptor *descriptor = obj->descriptor__ptr;
-
-            /* then mark it */
-            MARK(obj);
-            GGGGC_POOL_OF(obj)->survivors += descriptor->size;
-
-            /* add its pointers */
-            ADD_OBJECT_POINTERS(obj, descriptor);
-        }
+    /* give back the workers' unused buffers, so they leave no gaps in
+     * to-space (though copies lost to races still may). One worker's may only
+     * end where another's started, so go until none can */
+    do {
+        returned = FALSE;
+        for (i = 0; i < gcWorkerCount; i++)
+            returned |= returnCopyBuffer(&gcWorkers[i]);
+    } while (returned);
+
+    /* the survivors only matter in total, for growing the heap */
+    for (i = 0; i < gcWorkerCount; i++)
+        toSpace->survivors += gcWorkers[i].survivors;
+    ggggc_collectionPhase(GGGGC_PHASE_SWEEP);
+    report.full = TRUE;
+    report.remark = FALSE;
+    report.survivors = toSpace->survivors + sweepLarge();
+
+    /* from-space is now garbage, as is what's past the survivors in to-space */
+    for (poolCur = fromSpace; poolCur; poolCur = poolCur->next)
+        poolCur->free = poolCur->zeroed = poolCur->start;
+    for (poolCur = toSpace; poolCur; poolCur = poolCur->next)
+        poolCur->zeroed = poolCur->free;
+
+    /* flip */
+    poolOrder = !poolOrder;
+    ggggc_pool = toSpace;
+
+    /* resize for what survived, before measuring the heap */
+    ggggc_collectionPhase(GGGGC_PHASE_RESIZE);
+    ggggc_resizeSemispaces(toSpace, fromSpace, newSemispacePool, mustGrow, trimHeap);
+    if (trimHeap) trimSemispaces();
+    mustGrow = trimHeap = FALSE;
+
+    /* there's no free list, just what's past the survivors in each pool */
+    report.pools = report.heapWords = 0;
+    report.freeMeasured = TRUE;
+    report.freeWords = report.largestFree = 0;
+    lastUsed = 0;
+    for (poolCur = toSpace; poolCur; poolCur = poolCur->next) {
+        lastUsed += poolCur->free - poolCur->start;
+        report.pools++;
+        report.heapWords += poolCur->end - poolCur->start;
+        report.freeWords += poolCur->end - poolCur->free;
+        if ((ggc_size_t) (poolCur->end - poolCur->free) > report.largestFree)
+            report.largestFree = poolCur->end - poolCur->free;
     }
+    report.contiguousWords = report.freeWords;
+    ggggc_collectionEnd(&report);
+}
 
-    ggggc_processAndForward();
+void ggggc_trim()
+{
+    if (!ggggc_pool) return;
+    trimHeap = TRUE;
+    ggggc_collect0(1);
 }
 
 int ggggc_yield()
@@ -25,6 +25,47 @@
 extern "C" {
 #endif
 
+/* count trailing zeroes of a nonzero word */
+#if defined(__GNUC__) && !defined(GGGGC_NO_GNUC_FEATURES)
+#define GGGGC_CTZ(x) ((ggc_size_t) __builtin_ctzll((unsigned long long) (x)))
+#else
+static ggc_size_t GGGGC_CTZ(ggc_size_t x)
+{
+    ggc_size_t ret = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        ret++;
+    }
+    return ret;
+}
+#endif
+
+/* run body with curWord set to the index of each of an object's pointers,
+ * other than its descriptor. Pointer arrays are taken as a run of pointers,
+ * and otherwise only the set bits of the descriptor's bitmap are visited, so
+ * the cost is in the pointers rather than the object's size */
+#define GGGGC_FOR_EACH_POINTER(descriptor, curWord, body) do { \
+    ggc_size_t fepDescription, fepDescriptorWord, fepWords; \
+    if ((descriptor)->pointerArray) { \
+        for (curWord = (descriptor)->pointerArray; curWord < (descriptor)->size; curWord++) { \
+            body; \
+        } \
+    } else if ((descriptor)->pointers[0] & 1) { \
+        fepDescription = (descriptor)->pointers[0] & ~(ggc_size_t) 1; \
+        fepWords = GGGGC_DESCRIPTOR_WORDS_REQ((descriptor)->size); \
+        for (fepDescriptorWord = 0; fepDescriptorWord < fepWords; \
+             fepDescription = (++fepDescriptorWord < fepWords) ? \
+                (descriptor)->pointers[fepDescriptorWord] : 0) { \
+            while (fepDescription) { \
+                curWord = fepDescriptorWord * GGGGC_BITS_PER_WORD + GGGGC_CTZ(fepDescription); \
+                fepDescription &= fepDescription - 1; \
+                if (curWord >= (descriptor)->size) break; \
+                body; \
+            } \
+        } \
+    } \
+} while (0)
+
 /* allocate an object, collecting if impossible. Descriptor is for protection
  * only */
 void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, ggc_size_t size);
@@ -35,24 +76,72 @@ struct GGGGC_Pool *ggggc_newPool(int mustSucceed);
 /* allocate and initialize a pool, based on a prototype */
 struct GGGGC_Pool *ggggc_newPoolProto(struct GGGGC_Pool *pool);
 
-/* heuristically expand a pool list if it has too many survivors
- * poolList: Pool list to expand
- * newPool: Function to allocate a new pool based on a prototype pool
- * ratio: As a power of two, portion of pool that should be survivors */
-void ggggc_expandPoolList(struct GGGGC_Pool *poolList,
-                          struct GGGGC_Pool *(*newPool)(struct GGGGC_Pool *),
-                          int ratio);
+/* allocate a pool holding just one large object of the given size in words,
+ * at its start. Returns NULL if large pools aren't supported */
+struct GGGGC_Pool *ggggc_newLargePool(ggc_size_t size);
+
+/* free a large object's pool */
+void ggggc_freeLargePool(struct GGGGC_Pool *pool);
+
+/* the number of pools the heap policy wants, given the heap's state. Fills in
+ * status->gcPercent */
+ggc_size_t ggggc_heapTarget(struct GGGGC_HeapStatus *status);
+
+/* what a collector found in a collection, for the statistics. Sizes are in
+ * words */
+struct GGGGC_CollectionReport {
+    int full;                   /* was the whole heap collected? */
+    int remark;                 /* did it finish a concurrent mark? */
+    ggc_size_t allocated;       /* allocated since the last collection */
+    ggc_size_t survivors;       /* survived this one */
+    ggc_size_t pools, heapWords; /* pools in the heap, and their space for objects */
+    int freeMeasured;           /* were the pools all swept, and the rest filled in? */
+    ggc_size_t freeWords, largestFree;
+    ggc_size_t contiguousWords; /* the largest free chunk in each pool, added up */
+};
 
-/* free a generation (used when a thread exits) */
+/* bracket the time the world is stopped for collection, for the policy's GC
+ * time target and the statistics, and mark the start of each phase in it. The
+ * roots phase starts with the collection */
+void ggggc_collectionStart(void);
+void ggggc_collectionPhase(int phase);
+void ggggc_collectionEnd(const struct GGGGC_CollectionReport *report);
+
+/* likewise bracket the pause to start a concurrent mark */
+void ggggc_initialMarkStart(void);
+void ggggc_initialMarkEnd(void);
+
+/* the portion of time spent collecting, averaged over the last few collections */
+double ggggc_gcFraction(void);
+
+/* words this thread can allocate before its next allocation is sampled by the
+ * profiler. Starts at 0, so that each thread's first allocation reads the
+ * configuration, and is effectively unlimited while sampling is off */
+extern ggc_thread_local ggc_size_t ggggc_sampleLeft;
+
+/* record a sampled allocation */
+void ggggc_sampleAllocation(struct GGGGC_Descriptor *descriptor, ggc_size_t size);
+
+/* count an allocation against the sampling interval, sampling it if due */
+#define GGGGC_SAMPLE_ALLOCATION(descriptor, size) do { \
+    if ((size) >= ggggc_sampleLeft) \
+        ggggc_sampleAllocation((descriptor) ? *(descriptor) : NULL, (size)); \
+    else \
+        ggggc_sampleLeft -= (size); \
+} while(0)
+
+/* give the whole pages in a range of memory back to the OS. They read as
+ * zeroes when next touched */
+void ggggc_decommit(void *from, void *to);
+
+/* free a list of pools (used when a thread exits, or the heap shrinks) */
 void ggggc_freeGeneration(struct GGGGC_Pool *proto);
 
-void ggggc_processAndForward();
-
-void ggggc_updateRefs();
-
-void ggggc_nowExpand(struct GGGGC_Pool *poolList1, struct GGGGC_Pool *poolList2,
-                     struct GGGGC_Pool *(*newPool)(struct GGGGC_Pool *),
-                     int ratio, int expand);
+/* resize both semispaces after a collection, as the heap policy decides for
+ * the active one. Only the empty pools at their ends are released */
+void ggggc_resizeSemispaces(struct GGGGC_Pool *active, struct GGGGC_Pool *other,
+                            struct GGGGC_Pool *(*newPool)(void),
+                            int expand, int trim);
 
 /* run a collection */
 void ggggc_collect0(unsigned char gen);
@@ -117,6 +206,14 @@ extern struct GGGGC_Descriptor *ggggc_descriptorDescriptors[GGGGC_WORDS_PER_POOL
 /* and a lock for the descriptor descriptors */
 extern ggc_mutex_t ggggc_descriptorDescriptorsLock;
 
+/* cached array descriptors, by kind and size */
+#define GGGGC_ARRAY_DESCRIPTOR_PA 0
+#define GGGGC_ARRAY_DESCRIPTOR_DA 1
+extern struct GGGGC_Descriptor *ggggc_arrayDescriptors[2][GGGGC_ARRAY_DESCRIPTOR_CACHE];
+
+/* and a lock for them */
+extern ggc_mutex_t ggggc_arrayDescriptorsLock;
+
 #ifdef __cplusplus
 }
 #endif
@@ -60,6 +60,18 @@ typedef size_t ggc_size_t;
 #define GGGGC_POOL_SIZE 24 /* pool size as a power of 2 */
 #endif
 
+#ifndef GGGGC_LARGE_OBJECT
+#define GGGGC_LARGE_OBJECT 8192 /* objects of at least this many words get a pool of their own, and are never moved */
+#endif
+
+#ifndef GGGGC_ZERO_CHUNK
+#define GGGGC_ZERO_CHUNK 512 /* free space is zeroed ahead of allocation this many words at a time */
+#endif
+
+#ifndef GGGGC_ARRAY_DESCRIPTOR_CACHE
+#define GGGGC_ARRAY_DESCRIPTOR_CACHE 1024 /* arrays smaller than this (in words) share descriptors */
+#endif
+
 #ifndef GGGGC_CARD_SIZE
 #define GGGGC_CARD_SIZE 12 /* also a power of 2 */
 #endif
@@ -107,14 +119,22 @@ struct GGGGC_Pool {
     /* the next pool in this generation */
     struct GGGGC_Pool *next;
 
-    struct GGGGC_Pool *poolBuddy;
-
     /* the current free space and end of the pool */
     ggc_size_t *free, *end;
 
-    /* how much survived the last collection */
+    /* the free space is zeroed from free up to here */
+    ggc_size_t *zeroed;
+
+    /* how much survived the last collection. For a large pool, whether its
+     * object has been reached yet */
     ggc_size_t survivors;
 
+    /* is this a large object's pool of its own? */
+    int large;
+
+    /* is it on hugetlb pages? */
+    int hugetlb;
+
     /* and the actual content */
     ggc_size_t start[1];
 };
@@ -132,6 +152,8 @@ struct GGGGC_Descriptor {
     struct GGGGC_Header header;
     void *user__ptr; /* for the user to use however they please */
     ggc_size_t size; /* size of the described object in words */
+    ggc_size_t pointerArray; /* if nonzero, the object is a pointer array, and
+                              * every word from this one on is a pointer */
     ggc_size_t pointers[1]; /* location of pointers within the object (as a special
                          * case, if pointers[0]&1==0, this means "no pointers") */
 };
@@ -292,10 +314,12 @@ struct GGGGC_Descriptor *ggggc_allocateDescriptor(ggc_size_t size, ggc_size_t po
  * pointers */
 struct GGGGC_Descriptor *ggggc_allocateDescriptorL(ggc_size_t size, const ggc_size_t *pointers);
 
-/* descriptor allocator for pointer arrays */
+/* descriptor allocator for pointer arrays. Descriptors for arrays of fewer
+ * than GGGGC_ARRAY_DESCRIPTOR_CACHE words are cached and shared, so their
+ * user pointer must not be written */
 struct GGGGC_Descriptor *ggggc_allocateDescriptorPA(ggc_size_t size);
 
-/* descriptor allocator for data arrays */
+/* descriptor allocator for data arrays (also cached) */
 struct GGGGC_Descriptor *ggggc_allocateDescriptorDA(ggc_size_t size);
 
 /* allocate a descriptor from a descriptor slot */
@@ -310,6 +334,121 @@ extern volatile int ggggc_stopTheWorld;
 int ggggc_yield(void);
 #define GGC_YIELD() (ggggc_stopTheWorld ? ggggc_yield() : 0)
 
+/* the state of the heap after a collection, from which its size is chosen */
+struct GGGGC_HeapStatus {
+    ggc_size_t pools;           /* pools in the heap (in each semispace, if copying) */
+    ggc_size_t poolBytes;       /* memory each of those pools costs */
+    ggc_size_t spaceBytes;      /* space in the pools for objects */
+    ggc_size_t liveBytes;       /* how much of that survived the collection */
+    unsigned int gcPercent;     /* recent portion of run time the world was stopped to collect */
+    int mustGrow;               /* an allocation didn't fit even after collecting */
+    int trim;                   /* ggggc_trim asked for the heap to shrink as far as it can */
+};
+
+/* heap sizing policy. After each collection the heap grows to keep minFree
+ * percent of it free, or while collecting takes more than gcTime percent of
+ * the run time, and shrinks (by releasing empty pools) to keep no more than
+ * maxFree percent free. It never grows past maxHeap bytes unless an
+ * allocation can't otherwise succeed. Zero disables a limit. Each knob starts
+ * out from the environment variable named beside it. A sizer, if given,
+ * replaces all of this and returns the number of pools wanted. hugePages asks
+ * for pools allocated from then on to be on huge pages where possible */
+struct GGGGC_HeapPolicy {
+    ggc_size_t maxHeap;         /* GGGGC_MAX_HEAP (bytes, with optional K, M or G) */
+    unsigned int minFree;       /* GGGGC_MIN_FREE (default 50) */
+    unsigned int maxFree;       /* GGGGC_MAX_FREE (default 90) */
+    unsigned int gcTime;        /* GGGGC_GC_TIME (default 0) */
+    int hugePages;              /* GGGGC_HUGE_PAGES (default 0) */
+    ggc_size_t (*sizer)(const struct GGGGC_HeapStatus *status);
+};
+
+/* get or change the heap sizing policy. Changes apply from the next collection */
+void ggggc_getHeapPolicy(struct GGGGC_HeapPolicy *policy);
+void ggggc_setHeapPolicy(const struct GGGGC_HeapPolicy *policy);
+
+/* collect, then shrink the heap as far as the policy's minFree allows, giving
+ * unused memory back to the OS (e.g. after a spike in usage) */
+void ggggc_trim(void);
+
+/* how many pools have been allocated from the OS on each kind of page. With
+ * hugePages set, a pool is mapped from the system's reserved hugetlb pages if
+ * it has enough, or else advised to use transparent huge pages, which the
+ * kernel may or may not actually back it with */
+struct GGGGC_HugePageCounts {
+    ggc_size_t hugetlb;         /* pools on hugetlb pages */
+    ggc_size_t advised;         /* pools advised to use transparent huge pages */
+    ggc_size_t normal;          /* pools on normal pages */
+};
+void ggggc_getHugePageCounts(struct GGGGC_HugePageCounts *counts);
+
+/* the phases of a collection, as timed in GGGGC_Stats. Not every collector
+ * has every phase. A copying collector updates references as it copies, so
+ * that's part of the copy phase */
+enum {
+    GGGGC_PHASE_ROOTS,          /* finding the roots (and remembered objects) */
+    GGGGC_PHASE_MARK,           /* marking what's reachable from them */
+    GGGGC_PHASE_SWEEP,          /* sweeping, as much as is done in the pause */
+    GGGGC_PHASE_COPY,           /* copying or promoting survivors */
+    GGGGC_PHASE_RESIZE,         /* resizing the heap */
+    GGGGC_PHASES
+};
+
+/* pauses are counted in buckets by length. Bucket i counts pauses under 2^i
+ * microseconds, and the last one everything longer as well */
+#define GGGGC_PAUSE_BUCKETS 24
+
+/* statistics on collection. Times are in seconds. Each collection is also
+ * written as a line of JSON to the file descriptor in GGGGC_EVENT_FD, if set */
+struct GGGGC_Stats {
+    /* since the program started */
+    ggc_size_t collections;
+    ggc_size_t fullCollections; /* collections of the whole heap */
+    ggc_size_t bytesAllocated;
+    double pauseTotal, pauseMax;
+    double phaseTotal[GGGGC_PHASES];
+    ggc_size_t pauseHistogram[GGGGC_PAUSE_BUCKETS];
+
+    /* with concurrent marking, the pauses to start a mark, and to finish it
+     * (a remark, also counted as a collection above) */
+    ggc_size_t initialMarks, remarks;
+    double initialMarkTotal, initialMarkMax, remarkTotal, remarkMax;
+
+    /* in the last collection */
+    int lastFull;
+    double lastPause;
+    double lastPhase[GGGGC_PHASES];
+    ggc_size_t lastAllocated;   /* bytes allocated since the one before it */
+    ggc_size_t lastSurvivors;   /* bytes that survived it */
+    ggc_size_t pools;           /* pools in the heap */
+    ggc_size_t heapBytes;       /* space in the pools for objects */
+
+    /* free space in the heap's pools as of the last time they were all swept,
+     * the largest free chunk in it, and how fragmented it is: 0 if each pool's
+     * free space is in one chunk, approaching 1 as it's split into more */
+    ggc_size_t freeBytes, largestFree;
+    double fragmentation;
+};
+void ggggc_getStats(struct GGGGC_Stats *stats);
+
+/* the allocation profiler samples an allocation about every intervalBytes
+ * bytes (0 to stop), and records the C stack and embedder's context it was
+ * made in. GGGGC_ALLOC_SAMPLE sets the interval at startup. The profile is
+ * written in folded-stack form (as read by flamegraph.pl and pprof) at exit,
+ * on SIGUSR2 (at the next sample), or on request, to filename or else
+ * GGGGC_ALLOC_PROFILE, by default ggggc-alloc.folded */
+void ggggc_setAllocationSampling(ggc_size_t intervalBytes);
+int ggggc_dumpAllocationProfile(const char *filename);
+
+/* an embedder can name what it's doing, such as the function it's
+ * interpreting, by pushing a context here for the profiler. The name needn't
+ * be NUL-terminated, but must outlive the profile */
+struct GGGGC_AllocContext {
+    struct GGGGC_AllocContext *caller;
+    const char *name;
+    size_t nameLen;
+};
+extern ggc_thread_local struct GGGGC_AllocContext *ggggc_allocContext;
+
 /* to handle global variables, GGC_PUSH them then GGC_GLOBALIZE */
 void ggggc_globalize(void);
 #define GGC_GLOBALIZE() ggggc_globalize()
@@ -3,6 +3,7 @@
 /* publics */
 ggc_thread_local struct GGGGC_PointerStack *ggggc_pointerStack, *ggggc_pointerStackGlobals;
 ggc_thread_local void **ggc_jitPointerStack, **ggc_jitPointerStackTop;
+ggc_thread_local struct GGGGC_AllocContext *ggggc_allocContext;
 
 /* internals */
 volatile int ggggc_stopTheWorld;
@@ -19,8 +20,11 @@ struct GGGGC_JITPointerStackList *ggggc_blockedThreadJITPointerStacks;
 ggc_thread_local struct GGGGC_Pool *ggggc_fromPool;
 ggc_thread_local struct GGGGC_Pool *ggggc_toPool;
 ggc_thread_local struct GGGGC_Pool *ggggc_pool;
+ggc_thread_local ggc_size_t ggggc_sampleLeft;
 ggc_size_t poolOrder;
 struct GGGGC_Pool *ggggc_gens[GGGGC_GENERATIONS];
 struct GGGGC_Pool *ggggc_pools[GGGGC_GENERATIONS];
 struct GGGGC_Descriptor *ggggc_descriptorDescriptors[GGGGC_WORDS_PER_POOL/GGGGC_BITS_PER_WORD+sizeof(struct GGGGC_Descriptor)];
 ggc_mutex_t ggggc_descriptorDescriptorsLock;
+struct GGGGC_Descriptor *ggggc_arrayDescriptors[2][GGGGC_ARRAY_DESCRIPTOR_CACHE];
+ggc_mutex_t ggggc_arrayDescriptorsLock = GGC_MUTEX_INITIALIZER;
@@ -0,0 +1,244 @@
+/*
+ * Collection statistics and the event log
+ *
+ * Copyright (c) 2014, 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* for standards info */
+#if defined(unix) || defined(__unix) || defined(__unix__) || \
+    (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ggggc/gc.h"
+#include "ggggc-internals.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the phases' names, as they appear in the event log */
+static const char *phaseNames[GGGGC_PHASES] = {
+    "roots", "mark", "sweep", "copy", "resize"
+};
+
+/* the statistics so far */
+static ggc_mutex_t statsLock = GGC_MUTEX_INITIALIZER;
+static struct GGGGC_Stats stats;
+
+/* the event log (GGGGC_EVENT_FD), -1 if there is none, or -2 if the
+ * environment hasn't been read yet */
+static int eventFd = -2;
+
+/* the time, in seconds from some arbitrary point */
+static double now()
+{
+#if _POSIX_TIMERS > 0
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* the time of day, for the event log */
+static double wallTime()
+{
+#if _POSIX_TIMERS > 0
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    return (double) time(NULL);
+#endif
+}
+
+/* when the last collection started and ended, and the portion of time spent
+ * collecting, averaged over the last few collections */
+static double collectionStarted, collectionEnded, gcFraction;
+
+/* the phase in progress, when it started, and the time spent in each phase so
+ * far. Only the collecting thread touches these, with the world stopped */
+static int phase;
+static double phaseStarted, phaseTimes[GGGGC_PHASES];
+
+double ggggc_gcFraction()
+{
+    return gcFraction;
+}
+
+void ggggc_collectionStart()
+{
+    collectionStarted = phaseStarted = now();
+    phase = GGGGC_PHASE_ROOTS;
+    memset(phaseTimes, 0, sizeof(phaseTimes));
+}
+
+void ggggc_collectionPhase(int next)
+{
+    double t = now();
+    phaseTimes[phase] += t - phaseStarted;
+    phase = next;
+    phaseStarted = t;
+}
+
+/* open the event log, the first time there's something for it */
+static int eventLogOpen()
+{
+    const char *fd;
+    if (eventFd == -2) {
+        fd = getenv("GGGGC_EVENT_FD");
+        eventFd = (fd && *fd) ? atoi(fd) : -1;
+    }
+    return eventFd >= 0;
+}
+
+/* write a line to the event log, from a buffer of the given size */
+static void logEvent(const char *buf, int len, int size)
+{
+    if (len >= size) len = size - 1;
+#if _POSIX_VERSION
+    if (write(eventFd, buf, len) < 0)
+        eventFd = -1;
+#endif
+}
+
+/* write a collection to the event log, as a line of JSON */
+static void logCollection(const struct GGGGC_Stats *s, int remark)
+{
+    char buf[1024];
+    int len, i;
+
+    len = snprintf(buf, sizeof(buf),
+        "{\"event\":\"collection\",\"time\":%.6f,\"n\":%lu,\"full\":%s,"
+        "\"remark\":%s,\"pause\":%.9f,\"phases\":{",
+        wallTime(), (unsigned long) s->collections,
+        s->lastFull ? "true" : "false", remark ? "true" : "false", s->lastPause);
+    for (i = 0; i < GGGGC_PHASES; i++)
+        len += snprintf(buf + len, sizeof(buf) - len, "%s\"%s\":%.9f",
+            i ? "," : "", phaseNames[i], s->lastPhase[i]);
+    len += snprintf(buf + len, sizeof(buf) - len,
+        "},\"allocated\":%lu,\"survivors\":%lu,\"pools\":%lu,\"heapBytes\":%lu,"
+        "\"freeBytes\":%lu,\"largestFree\":%lu,\"fragmentation\":%.4f}\n",
+        (unsigned long) s->lastAllocated, (unsigned long) s->lastSurvivors,
+        (unsigned long) s->pools, (unsigned long) s->heapBytes,
+        (unsigned long) s->freeBytes, (unsigned long) s->largestFree,
+        s->fragmentation);
+
+    logEvent(buf, len, sizeof(buf));
+}
+
+void ggggc_collectionEnd(const struct GGGGC_CollectionReport *report)
+{
+    double end, total, pause;
+    ggc_size_t us, bucket;
+    struct GGGGC_Stats snapshot;
+    int i;
+
+    /* close the last phase */
+    ggggc_collectionPhase(phase);
+    end = phaseStarted;
+    pause = end - collectionStarted;
+
+    if (collectionEnded > 0) {
+        total = end - collectionEnded;
+        if (total > 0)
+            gcFraction = (gcFraction * 3 + pause / total) / 4;
+    }
+    collectionEnded = end;
+
+    /* pauses go in power-of-two buckets of microseconds */
+    us = (ggc_size_t) (pause * 1e6);
+    for (bucket = 0; bucket < GGGGC_PAUSE_BUCKETS - 1 && us >= ((ggc_size_t) 1 << bucket); bucket++);
+
+    ggc_mutex_lock_raw(&statsLock);
+    stats.collections++;
+    if (report->full) stats.fullCollections++;
+    stats.pauseTotal += pause;
+    if (pause > stats.pauseMax) stats.pauseMax = pause;
+    stats.pauseHistogram[bucket]++;
+    if (report->remark) {
+        stats.remarks++;
+        stats.remarkTotal += pause;
+        if (pause > stats.remarkMax) stats.remarkMax = pause;
+    }
+    for (i = 0; i < GGGGC_PHASES; i++) {
+        stats.phaseTotal[i] += phaseTimes[i];
+        stats.lastPhase[i] = phaseTimes[i];
+    }
+    stats.bytesAllocated += report->allocated * sizeof(ggc_size_t);
+
+    stats.lastFull = report->full;
+    stats.lastPause = pause;
+    stats.lastAllocated = report->allocated * sizeof(ggc_size_t);
+    stats.lastSurvivors = report->survivors * sizeof(ggc_size_t);
+    stats.pools = report->pools;
+    stats.heapBytes = report->heapWords * sizeof(ggc_size_t);
+    if (report->freeMeasured) {
+        stats.freeBytes = report->freeWords * sizeof(ggc_size_t);
+        stats.largestFree = report->largestFree * sizeof(ggc_size_t);
+        stats.fragmentation = report->freeWords ?
+            1.0 - (double) report->contiguousWords / report->freeWords : 0.0;
+    }
+    snapshot = stats;
+    ggc_mutex_unlock(&statsLock);
+
+    if (eventLogOpen())
+        logCollection(&snapshot, report->remark);
+}
+
+/* when the pause to start a concurrent mark started. Only the thread that
+ * stopped the world touches it */
+static double initialMarkStarted;
+
+void ggggc_initialMarkStart()
+{
+    initialMarkStarted = now();
+}
+
+void ggggc_initialMarkEnd()
+{
+    char buf[256];
+    double pause = now() - initialMarkStarted;
+    ggc_size_t n;
+
+    ggc_mutex_lock_raw(&statsLock);
+    n = ++stats.initialMarks;
+    stats.initialMarkTotal += pause;
+    if (pause > stats.initialMarkMax) stats.initialMarkMax = pause;
+    ggc_mutex_unlock(&statsLock);
+
+    if (eventLogOpen())
+        logEvent(buf, snprintf(buf, sizeof(buf),
+            "{\"event\":\"initialMark\",\"time\":%.6f,\"n\":%lu,\"pause\":%.9f}\n",
+            wallTime(), (unsigned long) n, pause), sizeof(buf));
+}
+
+void ggggc_getStats(struct GGGGC_Stats *ret)
+{
+    ggc_mutex_lock_raw(&statsLock);
+    *ret = stats;
+    ggc_mutex_unlock(&statsLock);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Array allocation microbenchmark: allocates short-lived pointer and data
+ * arrays of assorted small sizes, as a dynamic language's runtime does for
+ * its object members and strings. Prints arrays allocated per second, and
+ * how many pairs of same-sized arrays ended up with distinct descriptors
+ * (i.e., how many descriptors were allocated rather than shared).
+ *
+ * Usage: arraydesc [allocations] [max size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "ggggc/gc.h"
+
+/* Get the current time in milliseconds */
+static double currentTime(void)
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000.0 + t.tv_usec / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+    long allocations = 10000000, maxSize = 64, distinct = 0, i, sz;
+    unsigned long rng = 42;
+    double start, end;
+    GGC_voidpArray pa = NULL, pb = NULL;
+    GGC_long_Array da = NULL, db = NULL;
+
+    GGC_PUSH_4(pa, pb, da, db);
+
+    if (argc > 1) allocations = atol(argv[1]);
+    if (argc > 2) maxSize = atol(argv[2]);
+
+    start = currentTime();
+    for (i = 0; i < allocations; i += 4) {
+        rng = rng * 6364136223846793005UL + 1442695040888963407UL;
+        sz = (rng >> 33) % maxSize + 1;
+
+        /* two of each kind at the same size; both are rooted, so any
+         * collection in between leaves their descriptors comparable */
+        pa = GGC_NEW_PA(GGC_voidp, sz);
+        pb = GGC_NEW_PA(GGC_voidp, sz);
+        da = GGC_NEW_DA(long, sz);
+        db = GGC_NEW_DA(long, sz);
+
+        if (((struct GGGGC_Header *) pa)->descriptor__ptr !=
+            ((struct GGGGC_Header *) pb)->descriptor__ptr) distinct++;
+        if (((struct GGGGC_Header *) da)->descriptor__ptr !=
+            ((struct GGGGC_Header *) db)->descriptor__ptr) distinct++;
+    }
+    end = currentTime();
+
+    printf("%ld arrays (up to %ld elements) in %.0f ms: %.0f arrays/s, "
+        "%ld of %ld same-size pairs had distinct descriptors\n",
+        allocations, maxSize, end - start,
+        allocations / ((end - start) / 1000.0), distinct, allocations / 2);
+
+    return 0;
+}
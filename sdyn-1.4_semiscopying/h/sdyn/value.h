@@ -68,9 +68,12 @@ GGC_TYPE(SDyn_Number)
     GGC_MDATA(long, value);
 GGC_END_TYPE(SDyn_Number, GGC_NO_PTRS);
 
-/* boxed strings */
+/* boxed strings. hash is computed on first use (0 if not yet computed), and
+ * interned is set if this is the canonical copy in the intern table */
 GGC_TYPE(SDyn_String)
     GGC_MPTR(GGC_char_Array, value);
+    GGC_MDATA(size_t, hash);
+    GGC_MDATA(unsigned char, interned);
 GGC_END_TYPE(SDyn_String,
     GGC_PTR(SDyn_String, value)
     );
@@ -92,6 +95,10 @@ size_t SDyn_ShapeMapStringHash(SDyn_String str);
 int SDyn_ShapeMapStringCmp(SDyn_String strl, SDyn_String strr);
 GGC_MAP(SDyn_ShapeMap, SDyn_String, SDyn_Shape, SDyn_ShapeMapStringHash, SDyn_ShapeMapStringCmp);
 
+/* the intern table, mapping each string to its canonical copy */
+int SDyn_InternMapStringCmp(SDyn_String strl, SDyn_String strr);
+GGC_MAP(SDyn_InternMap, SDyn_String, SDyn_String, SDyn_ShapeMapStringHash, SDyn_InternMapStringCmp);
+
 /* map of strings to indexes (size_ts) */
 GGC_UNIT(size_t)
 GGC_MAP(SDyn_IndexMap, SDyn_String, GGC_size_t_Unit, SDyn_ShapeMapStringHash, SDyn_ShapeMapStringCmp);
@@ -105,6 +112,28 @@ GGC_END_TYPE(SDyn_Object,
     GGC_PTR(SDyn_Object, members)
     );
 
+/* inline cache for accesses to a named member: up to four shapes, most
+ * recently added first, each with the member's index in objects of that
+ * shape. Unused entries have a NULL shape */
+#define SDYN_INLINE_CACHE_SIZE 4
+GGC_TYPE(SDyn_InlineCache)
+    GGC_MPTR(SDyn_String, member);
+    GGC_MPTR(SDyn_Shape, shape0);
+    GGC_MPTR(SDyn_Shape, shape1);
+    GGC_MPTR(SDyn_Shape, shape2);
+    GGC_MPTR(SDyn_Shape, shape3);
+    GGC_MDATA(size_t, index0);
+    GGC_MDATA(size_t, index1);
+    GGC_MDATA(size_t, index2);
+    GGC_MDATA(size_t, index3);
+GGC_END_TYPE(SDyn_InlineCache,
+    GGC_PTR(SDyn_InlineCache, member)
+    GGC_PTR(SDyn_InlineCache, shape0)
+    GGC_PTR(SDyn_InlineCache, shape1)
+    GGC_PTR(SDyn_InlineCache, shape2)
+    GGC_PTR(SDyn_InlineCache, shape3)
+    );
+
 /* function (compiled) */
 typedef SDyn_Undefined (*sdyn_native_function_t)(void **pstack, size_t argCt, SDyn_Undefined *args);
 
@@ -124,6 +153,24 @@ extern SDyn_Boolean sdyn_false, sdyn_true;
 extern SDyn_Shape sdyn_emptyShape;
 extern SDyn_Object sdyn_globalObject;
 
+/* small integers (SMIs) are stored directly in SDyn_Undefined slots instead
+ * of being boxed: the value is shifted left and the low bit set, which no
+ * (aligned) pointer has, so the GC skips them. Integers too large for that
+ * are still boxed as SDyn_Numbers. Both are SDYN_TYPE_BOXED_INT */
+#define SDYN_IS_SMI(v)      ((size_t) (v) & 1)
+#define SDYN_SMI(i)         ((SDyn_Undefined) (((size_t) (i) << 1) | 1))
+#define SDYN_SMI_VALUE(v)   ((long) (size_t) (v) >> 1)
+#define SDYN_FITS_SMI(i)    (((long) ((size_t) (i) << 1) >> 1) == (long) (i))
+
+/* SMIs have no descriptor to carry a type tag, so they share this one */
+extern SDyn_Tag sdyn_smiTag;
+
+/* the type tag of any value */
+#define SDYN_TAG(v) (SDYN_IS_SMI(v) ? sdyn_smiTag : (SDyn_Tag) GGC_RUP(v))
+
+/* the value of an integer in either representation */
+#define SDYN_INT_VALUE(v) (SDYN_IS_SMI(v) ? SDYN_SMI_VALUE(v) : GGC_RD((SDyn_Number) (v), value))
+
 /* our global value initializer */
 void sdyn_initValues(void);
 
@@ -138,8 +185,8 @@ SDyn_Object sdyn_newObject(void **pstack);
 /* simple boxer for bool */
 SDyn_Boolean sdyn_boxBool(void **pstack, int value);
 
-/* simple boxer for ints */
-SDyn_Number sdyn_boxInt(void **pstack, long value);
+/* simple boxer for ints (a SMI if it fits) */
+SDyn_Undefined sdyn_boxInt(void **pstack, long value);
 
 /* simple boxer for strings */
 SDyn_String sdyn_boxString(void **pstack, char *value, size_t len);
@@ -147,6 +194,12 @@ SDyn_String sdyn_boxString(void **pstack, char *value, size_t len);
 /* and a specialized boxer for quoted strings */
 SDyn_String sdyn_unquote(SDyn_String istr);
 
+/* get the canonical (interned) copy of a string, interning it if necessary */
+SDyn_String sdyn_intern(void **pstack, SDyn_String str);
+
+/* get the canonical copy of a string if it's been interned, or NULL */
+SDyn_String sdyn_findInterned(void **pstack, SDyn_String str);
+
 /* type coercions */
 int sdyn_toBoolean(void **pstack, SDyn_Undefined value);
 long sdyn_toNumber(void **pstack, SDyn_Undefined value);
@@ -169,6 +222,21 @@ SDyn_Undefined sdyn_getObjectMember(void **pstack, SDyn_Object object, SDyn_Stri
 /* set or add a member on/to an object */
 void sdyn_setObjectMember(void **pstack, SDyn_Object object, SDyn_String member, SDyn_Undefined value);
 
+/* create an (empty) inline cache for the given member */
+SDyn_InlineCache sdyn_newInlineCache(SDyn_String member);
+
+/* get a member of an object on an inline cache miss, adding the object's shape
+ * to the cache */
+SDyn_Undefined sdyn_getObjectMemberIC(void **pstack, SDyn_Object object, SDyn_InlineCache cache);
+
+/* set or add a member on an inline cache miss, adding the object's shape to
+ * the cache if the member already existed */
+void sdyn_setObjectMemberIC(void **pstack, SDyn_Object object, SDyn_InlineCache cache, SDyn_Undefined value);
+
+/* set a member at an index already known from an inline cache, for when the
+ * write barrier can't be skipped */
+void sdyn_setObjectMemberIndex(void **pstack, SDyn_Object object, size_t idx, SDyn_Undefined value);
+
 /* the ever-complicated add function */
 SDyn_Undefined sdyn_add(void **pstack, SDyn_Undefined left, SDyn_Undefined right);
 
@@ -32,18 +32,36 @@
 size_t SDyn_ShapeMapStringHash(SDyn_String str)
 {
     GGC_char_Array arr = NULL;
-    size_t i, ret = 0;
+    size_t i, ret;
+
+    /* strings are immutable, so the hash only needs computing once */
+    if ((ret = GGC_RD(str, hash)))
+        return ret;
 
     GGC_PUSH_2(str, arr);
     arr = GGC_RP(str, value);
 
     for (i = 0; i < arr->length; i++)
         ret = ((unsigned char) GGC_RAD(arr, i)) + (ret << 16) - ret;
+    if (ret == 0) ret = 1;
+    GGC_WD(str, hash, ret);
 
     return ret;
 }
 
+/* shape and index maps are keyed by interned strings (see
+ * sdyn_getObjectMemberIndex), so in the common case this is a pointer
+ * comparison. Only equality is meaningful */
 int SDyn_ShapeMapStringCmp(SDyn_String strl, SDyn_String strr)
+{
+    if (strl == strr) return 0;
+    if (GGC_RD(strl, interned) && GGC_RD(strr, interned)) return 1;
+    if (GGC_RD(strl, hash) && GGC_RD(strr, hash) &&
+        GGC_RD(strl, hash) != GGC_RD(strr, hash)) return 1;
+    return SDyn_InternMapStringCmp(strl, strr);
+}
+
+int SDyn_InternMapStringCmp(SDyn_String strl, SDyn_String strr)
 {
     GGC_char_Array arrl = NULL, arrr = NULL;
     size_t lenl, lenr, minlen;
@@ -74,10 +92,13 @@ SDyn_Undefined sdyn_undefined = NULL;
 SDyn_Boolean sdyn_false = NULL, sdyn_true = NULL;
 SDyn_Shape sdyn_emptyShape = NULL;
 SDyn_Object sdyn_globalObject = NULL;
+SDyn_Tag sdyn_smiTag = NULL;
+static SDyn_InternMap internTable = NULL;
 
 static void pushGlobals()
 {
-    GGC_PUSH_5(sdyn_undefined, sdyn_false, sdyn_true, sdyn_emptyShape, sdyn_globalObject);
+    GGC_PUSH_7(sdyn_undefined, sdyn_false, sdyn_true, sdyn_emptyShape, sdyn_globalObject, sdyn_smiTag,
+        internTable);
     GGC_GLOBALIZE();
     return;
 }
@@ -114,17 +135,19 @@ void sdyn_initValues()
     sdyn_true = GGC_NEW(SDyn_Boolean);
     GGC_WD(sdyn_true, value, 1);
 
-    /* number */
+    /* number (boxed or SMI) */
     tag = GGC_NEW(SDyn_Tag);
     GGC_WD(tag, type, SDYN_TYPE_BOXED_INT);
     number = GGC_NEW(SDyn_Number);
     GGC_WUP(number, tag);
+    sdyn_smiTag = tag;
 
     /* string */
     tag = GGC_NEW(SDyn_Tag);
     GGC_WD(tag, type, SDYN_TYPE_STRING);
     string = GGC_NEW(SDyn_String);
     GGC_WUP(string, tag);
+    internTable = GGC_NEW(SDyn_InternMap);
 
     /* the empty shape */
     sdyn_emptyShape = GGC_NEW(SDyn_Shape);
@@ -163,7 +186,7 @@ SDyn_Function sdyn_boxFunction(SDyn_Node ast)
 {
     SDyn_Function ret = NULL;
 
-    GGC_PUSH_1(ret);
+    GGC_PUSH_2(ast, ret);
 
     ret = GGC_NEW(SDyn_Function);
     GGC_WP(ret, ast, ast);
@@ -202,18 +225,21 @@ SDyn_Boolean sdyn_boxBool(void **pstack, int value)
         return sdyn_false;
 }
 
-/* simple boxer for ints */
-SDyn_Number sdyn_boxInt(void **pstack, long value)
+/* simple boxer for ints (a SMI if it fits) */
+SDyn_Undefined sdyn_boxInt(void **pstack, long value)
 {
     SDyn_Number ret = NULL;
 
+    if (SDYN_FITS_SMI(value))
+        return SDYN_SMI(value);
+
     PSTACK();
     GGC_PUSH_1(ret);
 
     ret = GGC_NEW(SDyn_Number);
     GGC_WD(ret, value, value);
 
-    return ret;
+    return (SDyn_Undefined) ret;
 }
 
 /* simple boxer for strings */
@@ -279,18 +305,50 @@ SDyn_String sdyn_unquote(SDyn_String istr)
     return ret;
 }
 
+/* get the canonical (interned) copy of a string, interning it if necessary */
+SDyn_String sdyn_intern(void **pstack, SDyn_String str)
+{
+    SDyn_String ret = NULL;
+
+    if (GGC_RD(str, interned)) return str;
+
+    PSTACK();
+    GGC_PUSH_2(str, ret);
+
+    if (SDyn_InternMapGet(internTable, str, &ret))
+        return ret;
+
+    GGC_WD(str, interned, 1);
+    SDyn_InternMapPut(internTable, str, str);
+    return str;
+}
+
+/* get the canonical copy of a string if it's been interned, or NULL */
+SDyn_String sdyn_findInterned(void **pstack, SDyn_String str)
+{
+    SDyn_String ret = NULL;
+
+    if (GGC_RD(str, interned)) return str;
+
+    PSTACK();
+    GGC_PUSH_2(str, ret);
+
+    if (SDyn_InternMapGet(internTable, str, &ret))
+        return ret;
+    return NULL;
+}
+
 /* coerce to boolean */
 int sdyn_toBoolean(void **pstack, SDyn_Undefined value)
 {
     SDyn_Tag tag = NULL;
     SDyn_Boolean boolean = NULL;
-    SDyn_Number number = NULL;
     SDyn_String string = NULL;
 
     PSTACK();
-    GGC_PUSH_5(value, tag, boolean, number, string);
+    GGC_PUSH_4(value, tag, boolean, string);
 
-    tag = (SDyn_Tag) GGC_RUP(value);
+    tag = SDYN_TAG(value);
     switch (GGC_RD(tag, type)) {
         case SDYN_TYPE_BOXED_BOOL:
             boolean = (SDyn_Boolean) value;
@@ -300,8 +358,7 @@ int sdyn_toBoolean(void **pstack, SDyn_Undefined value)
             return 0;
 
         case SDYN_TYPE_BOXED_INT:
-            number = (SDyn_Number) value;
-            return GGC_RD(number, value) ? 1 : 0;
+            return SDYN_INT_VALUE(value) ? 1 : 0;
 
         case SDYN_TYPE_STRING:
             string = (SDyn_String) value;
@@ -316,19 +373,17 @@ int sdyn_toBoolean(void **pstack, SDyn_Undefined value)
 long sdyn_toNumber(void **pstack, SDyn_Undefined value)
 {
     SDyn_Tag tag = NULL;
-    SDyn_Number number = NULL;
     SDyn_Boolean boolean = NULL;
     SDyn_String string = NULL;
     GGC_char_Array strRaw = NULL;
 
     PSTACK();
-    GGC_PUSH_6(value, tag, number, boolean, string, strRaw);
+    GGC_PUSH_5(value, tag, boolean, string, strRaw);
 
-    tag = (SDyn_Tag) GGC_RUP(value);
+    tag = SDYN_TAG(value);
     switch (GGC_RD(tag, type)) {
         case SDYN_TYPE_BOXED_INT:
-            number = (SDyn_Number) value;
-            return GGC_RD(number, value);
+            return SDYN_INT_VALUE(value);
 
         case SDYN_TYPE_BOXED_UNDEFINED:
             return 0;
@@ -372,12 +427,11 @@ SDyn_String sdyn_toString(void **pstack, SDyn_Undefined value)
     SDyn_String ret = NULL;
     GGC_char_Array ca = NULL;
     SDyn_Boolean boolean = NULL;
-    SDyn_Number number = NULL;
 
     PSTACK();
-    GGC_PUSH_6(value, tag, ret, ca, boolean, number);
+    GGC_PUSH_5(value, tag, ret, ca, boolean);
 
-    tag = (SDyn_Tag) GGC_RUP(value);
+    tag = SDYN_TAG(value);
     switch (GGC_RD(tag, type)) {
         case SDYN_TYPE_STRING:
             return (SDyn_String) value;
@@ -410,10 +464,9 @@ SDyn_String sdyn_toString(void **pstack, SDyn_Undefined value)
             size_t len;
             long val, tmp;
             int negative;
-            number = (SDyn_Number) value;
 
             /* first determine the necessary length */
-            val = GGC_RD(number, value);
+            val = SDYN_INT_VALUE(value);
             negative = (val<0);
             if (negative) {
                 val *= -1;
@@ -483,7 +536,7 @@ SDyn_Object sdyn_toObject(void **pstack, SDyn_Undefined value)
     PSTACK();
     GGC_PUSH_2(value, tag);
 
-    tag = (SDyn_Tag) GGC_RUP(value);
+    tag = SDYN_TAG(value);
     if (GGC_RD(tag, type) == SDYN_TYPE_OBJECT) return (SDyn_Object) value;
 
     /* it's not an object, so just give nonsense */
@@ -497,7 +550,7 @@ SDyn_Undefined sdyn_toValue(void **pstack, SDyn_Undefined value)
 
     PSTACK();
     GGC_PUSH_2(value, tag);
-    tag = (SDyn_Tag) GGC_RUP(value);
+    tag = SDYN_TAG(value);
     switch (GGC_RD(tag, type)) {
         case SDYN_TYPE_BOXED_INT:
         case SDYN_TYPE_STRING:
@@ -516,7 +569,7 @@ SDyn_Function sdyn_assertFunction(void **pstack, SDyn_Function func)
     PSTACK();
     GGC_PUSH_2(func, tag);
 
-    tag = (SDyn_Tag) GGC_RUP(func);
+    tag = SDYN_TAG(func);
     if (GGC_RD(tag, type) != SDYN_TYPE_FUNCTION) {
         fprintf(stderr, "Attempt to call a non-function (type %d)!\n", GGC_RD(tag, type));
         abort();
@@ -535,7 +588,7 @@ SDyn_String sdyn_typeof(void **pstack, SDyn_Undefined value)
     PSTACK();
     GGC_PUSH_4(value, tag, reta, ret);
 
-    tag = (SDyn_Tag) GGC_RUP(value);
+    tag = SDYN_TAG(value);
 
     /* macro to load a string into GGC */
 #define LSTR(str) do { \
@@ -575,6 +628,15 @@ size_t sdyn_getObjectMemberIndex(void **pstack, SDyn_Object object, SDyn_String
     GGC_PUSH_9(object, member, shape, cshape, shapeChildren, shapeMembers,
         oldObjectMembers, newObjectMembers, indexBox);
 
+    /* every member name in a shape is interned, so a name that isn't can't be
+     * a member of anything */
+    if (create) {
+        member = sdyn_intern(NULL, member);
+    } else {
+        member = sdyn_findInterned(NULL, member);
+        if (!member) return (size_t) -1;
+    }
+
     shape = GGC_RP(object, shape);
 
     /* first check if it already exists */
@@ -655,27 +717,114 @@ void sdyn_setObjectMember(void **pstack, SDyn_Object object, SDyn_String member,
     return;
 }
 
+/* set a member at an index already known from an inline cache */
+void sdyn_setObjectMemberIndex(void **pstack, SDyn_Object object, size_t idx, SDyn_Undefined value)
+{
+    SDyn_UndefinedArray members = GGC_RP(object, members);
+    GGC_WAP(members, idx, value);
+}
+
+/* create an (empty) inline cache for the given member */
+SDyn_InlineCache sdyn_newInlineCache(SDyn_String member)
+{
+    SDyn_InlineCache ret = NULL;
+
+    GGC_PUSH_2(member, ret);
+
+    member = sdyn_intern(NULL, member);
+    ret = GGC_NEW(SDyn_InlineCache);
+    GGC_WP(ret, member, member);
+
+    return ret;
+}
+
+/* add a shape to an inline cache, pushing out the oldest entry */
+static void inlineCacheAdd(SDyn_InlineCache cache, SDyn_Shape shape, size_t idx)
+{
+    SDyn_Shape eshape;
+    size_t eidx;
+
+#define SHIFT(from, to) do { \
+    eshape = GGC_RP(cache, shape ## from); \
+    GGC_WP(cache, shape ## to, eshape); \
+    eidx = GGC_RD(cache, index ## from); \
+    GGC_WD(cache, index ## to, eidx); \
+} while(0)
+    SHIFT(2, 3);
+    SHIFT(1, 2);
+    SHIFT(0, 1);
+#undef SHIFT
+
+    GGC_WP(cache, shape0, shape);
+    GGC_WD(cache, index0, idx);
+}
+
+/* get a member of an object on an inline cache miss */
+SDyn_Undefined sdyn_getObjectMemberIC(void **pstack, SDyn_Object object, SDyn_InlineCache cache)
+{
+    SDyn_String member = NULL;
+    SDyn_Shape shape = NULL;
+    SDyn_UndefinedArray members = NULL;
+    size_t idx;
+
+    PSTACK();
+    GGC_PUSH_5(object, cache, member, shape, members);
+
+    member = GGC_RP(cache, member);
+    if ((idx = sdyn_getObjectMemberIndex(NULL, object, member, 0)) == (size_t) -1)
+        return sdyn_undefined;
+
+    /* there's a member to find, so remember where */
+    shape = GGC_RP(object, shape);
+    inlineCacheAdd(cache, shape, idx);
+
+    members = GGC_RP(object, members);
+    return GGC_RAP(members, idx);
+}
+
+/* set or add a member on an inline cache miss */
+void sdyn_setObjectMemberIC(void **pstack, SDyn_Object object, SDyn_InlineCache cache, SDyn_Undefined value)
+{
+    SDyn_String member = NULL;
+    SDyn_Shape shape = NULL;
+    SDyn_UndefinedArray members = NULL;
+    size_t idx;
+
+    PSTACK();
+    GGC_PUSH_6(object, cache, value, member, shape, members);
+
+    member = GGC_RP(cache, member);
+    shape = GGC_RP(object, shape);
+    idx = sdyn_getObjectMemberIndex(NULL, object, member, 1);
+
+    /* adding a member changes the shape, and that isn't cached */
+    if (GGC_RP(object, shape) == shape)
+        inlineCacheAdd(cache, shape, idx);
+
+    members = GGC_RP(object, members);
+    GGC_WAP(members, idx, value);
+
+    return;
+}
+
 /* the ever-complicated add function */
 SDyn_Undefined sdyn_add(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
 {
     SDyn_Tag ltag = NULL, rtag = NULL;
-    SDyn_Number ln = NULL, rn = NULL;
     SDyn_String ls = NULL, rs = NULL, rets = NULL;
     GGC_char_Array lsa = NULL, rsa = NULL, retsa = NULL;
 
     PSTACK();
-    GGC_PUSH_12(left, right, ltag, rtag, ln, rn, ls, rs, rets, lsa, rsa, retsa);
+    GGC_PUSH_10(left, right, ltag, rtag, ls, rs, rets, lsa, rsa, retsa);
 
-    ltag = (SDyn_Tag) GGC_RUP(left);
-    rtag = (SDyn_Tag) GGC_RUP(right);
+    ltag = SDYN_TAG(left);
+    rtag = SDYN_TAG(right);
 
     /* only if both are numbers do we add them as numbers */
     if (GGC_RD(ltag, type) == SDYN_TYPE_BOXED_INT && GGC_RD(rtag, type) == SDYN_TYPE_BOXED_INT) {
         long retv;
-        ln = (SDyn_Number) left;
-        rn = (SDyn_Number) right;
-        retv = GGC_RD(ln, value) + GGC_RD(rn, value);
-        return (SDyn_Undefined) sdyn_boxInt(NULL, retv);
+        retv = SDYN_INT_VALUE(left) + SDYN_INT_VALUE(right);
+        return sdyn_boxInt(NULL, retv);
     }
 
     /* need to convert to strings */
@@ -739,16 +888,15 @@ int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
      */
 
     SDyn_Tag ltag = NULL, rtag = NULL;
-    SDyn_Number lnum = NULL, rnum = NULL;
     SDyn_String lstr = NULL, rstr = NULL;
     GGC_char_Array lstra = NULL, rstra = NULL;
     int ltagv, rtagv;
 
     PSTACK();
-    GGC_PUSH_10(left, right, ltag, rtag, lnum, rnum, lstr, rstr, lstra, rstra);
+    GGC_PUSH_8(left, right, ltag, rtag, lstr, rstr, lstra, rstra);
 
-    ltag = (SDyn_Tag) GGC_RUP(left);
-    rtag = (SDyn_Tag) GGC_RUP(right);
+    ltag = SDYN_TAG(left);
+    rtag = SDYN_TAG(right);
     ltagv = GGC_RD(ltag, type);
     rtagv = GGC_RD(rtag, type);
     retry:
@@ -761,9 +909,7 @@ int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
         switch (ltagv) {
             case SDYN_TYPE_BOXED_INT:
                 /* compare values */
-                lnum = (SDyn_Number) left;
-                rnum = (SDyn_Number) right;
-                return (GGC_RD(lnum, value) == GGC_RD(rnum, value));
+                return (SDYN_INT_VALUE(left) == SDYN_INT_VALUE(right));
 
             case SDYN_TYPE_STRING:
             {
@@ -771,6 +917,7 @@ int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
 
                 lstr = (SDyn_String) left;
                 rstr = (SDyn_String) right;
+                if (lstr == rstr) return 1;
                 lstra = GGC_RP(lstr, value);
                 rstra = GGC_RP(rstr, value);
 
@@ -794,12 +941,12 @@ int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
 
     /* not the same type. Is one of them a boolean? */
     if (ltagv == SDYN_TYPE_BOXED_BOOL) {
-        left = (SDyn_Undefined) sdyn_boxInt(NULL, sdyn_toNumber(NULL, left));
+        left = sdyn_boxInt(NULL, sdyn_toNumber(NULL, left));
         ltagv = SDYN_TYPE_BOXED_INT;
         goto retry;
     }
     if (rtagv == SDYN_TYPE_BOXED_BOOL) {
-        right = (SDyn_Undefined) sdyn_boxInt(NULL, sdyn_toNumber(NULL, right));
+        right = sdyn_boxInt(NULL, sdyn_toNumber(NULL, right));
         rtagv = SDYN_TYPE_BOXED_INT;
         goto retry;
     }
@@ -816,12 +963,12 @@ int sdyn_equal(void **pstack, SDyn_Undefined left, SDyn_Undefined right)
 
     /* is it (number,string) or (string,number)? */
     if (ltagv == SDYN_TYPE_BOXED_INT && rtagv == SDYN_TYPE_STRING) {
-        right = (SDyn_Undefined) sdyn_boxInt(NULL, sdyn_toNumber(NULL, right));
+        right = sdyn_boxInt(NULL, sdyn_toNumber(NULL, right));
         rtagv = SDYN_TYPE_BOXED_INT;
         goto retry;
     }
     if (ltagv == SDYN_TYPE_STRING && rtagv == SDYN_TYPE_BOXED_INT) {
-        left = (SDyn_Undefined) sdyn_boxInt(NULL, sdyn_toNumber(NULL, left));
+        left = sdyn_boxInt(NULL, sdyn_toNumber(NULL, left));
         ltagv = SDYN_TYPE_BOXED_INT;
         goto retry;
     }
@@ -860,11 +1007,24 @@ sdyn_native_function_t sdyn_assertCompiled(void **pstack, SDyn_Function func)
 SDyn_Undefined sdyn_call(void **pstack, SDyn_Function func, size_t argCt, SDyn_Undefined *args)
 {
     sdyn_native_function_t nfunc;
+    struct GGGGC_AllocContext context;
+    SDyn_Node ast = NULL;
+    SDyn_Undefined ret;
 
     PSTACK();
-    GGC_PUSH_1(func);
+    GGC_PUSH_2(func, ast);
 
     nfunc = sdyn_assertCompiled(NULL, func);
 
-    return nfunc(ggc_jitPointerStack, argCt, args);
+    /* name the function to the allocation profiler while it runs */
+    ast = GGC_RP(func, ast);
+    context.caller = ggggc_allocContext;
+    context.name = (const char *) GGC_RD(ast, tok).val;
+    context.nameLen = GGC_RD(ast, tok).valLen;
+    ggggc_allocContext = &context;
+
+    ret = nfunc(ggc_jitPointerStack, argCt, args);
+
+    ggggc_allocContext = context.caller;
+    return ret;
 }
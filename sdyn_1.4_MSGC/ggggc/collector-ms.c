@@ -1,403 +1,2069 @@
-/*
- * Object allocation and the actual garbage collector
- *
- * Copyright (c) 2014, 2015 Gregor Richards
- *
- * Permission to use, copy, modify, and/or distribute this software for any
- * purpose with or without fee is hereby granted, provided that the above
- * copyright notice and this permission notice appear in all copies.
- *
- * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
- * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
- * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
- * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
- * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
- * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
- * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
- */
-
-#include "ggggc/gc.h"
-
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <sys/types.h>
-
-#include "ggggc-internals.h"
-
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-#define TRUE 1
-#define FALSE 0
-
-/* Since my final project is to build partition type GC, I decide to follow the TeSearchList in collector-gembc for
- * marking */
-#define TOSEARCH_SZ 1024
-struct ToSearch {
-    struct ToSearch *prev, *next;
-    ggc_size_t used;
-    void **buf;
-};
-
-#define TOSEARCH_INIT() do { \
-    if (toSearchList.buf == NULL) { \
-        toSearchList.buf = (void **) malloc(TOSEARCH_SZ * sizeof(void *)); \
-        if (toSearchList.buf == NULL) { \
-            /* FIXME: handle somehow? */ \
-            perror("malloc"); \
-            abort(); \
-        } \
-    } \
-    toSearch = &toSearchList; \
-    toSearch->used = 0; \
-} while(0)
-#define TOSEARCH_NEXT() do { \
-    if (!toSearch->next) { \
-        struct ToSearch *tsn = (struct ToSearch *) malloc(sizeof(struct ToSearch)); \
-        toSearch->next = tsn; \
-        tsn->prev = toSearch; \
-        tsn->next = NULL; \
-        tsn->buf = (void **) malloc(TOSEARCH_SZ * sizeof(void *)); \
-        if (tsn->buf == NULL) { \
-            perror("malloc"); \
-            abort(); \
-        } \
-    } \
-    toSearch = toSearch->next; \
-    toSearch->used = 0; \
-} while(0)
-#define TOSEARCH_ADD(ptr) do { \
-    if (toSearch->used >= TOSEARCH_SZ) TOSEARCH_NEXT(); \
-    toSearch->buf[toSearch->used++] = (ptr); \
-} while(0)
-#define TOSEARCH_POP(type, into) do { \
-    into = (type) toSearch->buf[--toSearch->used]; \
-    if (toSearch->used == 0 && toSearch->prev) \
-        toSearch = toSearch->prev; \
-} while(0)
-/* macro to add an object's pointers to the tosearch list */
-#define ADD_OBJECT_POINTERS(obj, descriptor) do { \
-    void **objVp = (void **) (obj); \
-    ggc_size_t curWord, curDescription, curDescriptorWord = 0; \
-    if (descriptor->pointers[0] & 1) { \
-        /* it has pointers */ \
-        curDescription = descriptor->pointers[0] >> 1; \
-        for (curWord = 1; curWord < descriptor->size; curWord++) { \
-            if (curWord % GGGGC_BITS_PER_WORD == 0) \
-                curDescription = descriptor->pointers[++curDescriptorWord]; \
-            if (curDescription & 1) \
-                /* it's a pointer */ \
-                TOSEARCH_ADD(&objVp[curWord]); \
-            curDescription >>= 1; \
-        } \
-    } \
-    TOSEARCH_ADD(&objVp[0]); \
-} while(0)
-
-
-/* mark an object */
-#define MARK(obj) do { \
-    struct GGGGC_Header *hobj = (obj); \
-    hobj->descriptor__ptr = (struct GGGGC_Descriptor *) \
-        ((ggc_size_t) hobj->descriptor__ptr | (ggc_size_t) 1); \
-} while (0)
-
-/* unmark a pointer */
-#define UNMARK_PTR(type, ptr) \
-    ((type *) ((ggc_size_t) (ptr) & (ggc_size_t) ~1))
-
-/* get an object's descriptor, through markers */
-#define MARKED_DESCRIPTOR(obj) \
-    (UNMARK_PTR(struct GGGGC_Descriptor, (obj)->descriptor__ptr))
-
-/* unmark an object */
-#define UNMARK(obj) do { \
-    struct GGGGC_Header *hobj = (obj); \
-    hobj->descriptor__ptr = UNMARK_PTR(struct GGGGC_Descriptor, hobj->descriptor__ptr); \
-} while (0)
-
-/* is this pointer marked? */
-#define IS_MARKED_PTR(ptr) ((ggc_size_t) (ptr) & 1)
-
-/* is this object marked? */
-#define IS_MARKED(obj) IS_MARKED_PTR((obj)->descriptor__ptr)
-
-
-/* free an object */
-#define FREE(obj) do { \
-    struct GGGGC_Free *fobj = (obj); \
-    fobj->next = (struct GGGGC_Free *) \
-        ((ggc_size_t) fobj->next | 2); \
-} while (0)
-
-/* get a free object's next object, through markers */
-#define FREED_OBJECT(obj) \
-    (UNFREE_PTR(struct GGGGC_FREE, (obj)->next))
-
-/* unfree a pointer*/
-#define UNFREE_PTR(type, ptr) \
-    ((type *) ((ggc_size_t) (ptr) & (ggc_size_t) ~2))
-
-#define UNFREE(obj) do { \
-    struct GGGGC_Free *fobj = (obj); \
-    fobj->next = UNFREE_PTR(struct GGGGC_Free, fobj->next); \
-} while (0)
-
-#define IS_FREE_PTR(ptr) ((ggc_size_t) (ptr) & 2)
-
-#define IS_FREE(obj) IS_FREE_PTR((obj)->next)
-
-static struct ToSearch toSearchList;
-
-void ggggc_markPhase()
-{
-    struct GGGGC_PoolList pool0Node, *plCur;
-    struct GGGGC_Pool *poolCur;
-    struct GGGGC_PointerStackList pointerStackNode, *pslCur;
-    struct GGGGC_JITPointerStackList jitPointerStackNode, *jpslCur;
-    struct GGGGC_PointerStack *psCur;
-    void **jpsCur;
-    struct ToSearch *toSearch;
-    ggc_size_t i;
-
-    TOSEARCH_INIT();
-
-    /* initialize our roots */
-    ggc_mutex_lock_raw(&ggggc_rootsLock);
-    pointerStackNode.pointerStack = ggggc_pointerStack;
-    pointerStackNode.next = ggggc_blockedThreadPointerStacks;
-    ggggc_rootPointerStackList = &pointerStackNode;
-    jitPointerStackNode.cur = ggc_jitPointerStack;
-    jitPointerStackNode.top = ggc_jitPointerStackTop;
-    jitPointerStackNode.next = ggggc_blockedThreadJITPointerStacks;
-    ggggc_rootJITPointerStackList = &jitPointerStackNode;
-    ggc_mutex_unlock(&ggggc_rootsLock);
-
-
-    /* add our roots to the to-search list */
-    for (pslCur = ggggc_rootPointerStackList; pslCur; pslCur = pslCur->next) {
-        for (psCur = pslCur->pointerStack; psCur; psCur = psCur->next) {
-            for (i = 0; i < psCur->size; i++) {
-                TOSEARCH_ADD(psCur->pointers[i]);
-            }
-        }
-    }
-    for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
-        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++) {
-            TOSEARCH_ADD(jpsCur);
-        }
-    }
-
-    /* The marking phase */
-    while (toSearch->used) {
-        void **ptr;
-        struct GGGGC_Header *obj;
-
-        TOSEARCH_POP(void **, ptr);
-        obj = (struct GGGGC_Header *) *ptr;
-        if (obj == NULL) continue;
-        obj = UNMARK_PTR(struct GGGGC_Header, obj);
-
-        /* if the object isn't already marked... */
-        if (!IS_MARKED(obj)) {
-            struct GGGGC_Descriptor *descriptor = obj->descriptor__ptr;
-
-            /* then mark it */
-            MARK(obj);
-            GGGGC_POOL_OF(obj)->survivors += descriptor->size;
-
-            /* add its pointers */
-            ADD_OBJECT_POINTERS(obj, descriptor);
-        }
-    }
-}
-
-void ggggc_markAllFreeObjects ()
-{
-    struct GGGGC_Pool *poolCur;
-    struct GGGGC_Free *curFree, *tempFree;
-
-    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next) {
-        curFree = poolCur->freeList;
-        while (curFree) {
-            tempFree = curFree->next;
-            FREE(curFree);
-            curFree = tempFree;
-        }
-    }
-}
-
-void ggggc_sweep()
-{
-    struct GGGGC_Pool *poolCur;
-    struct GGGGC_Header *header;
-    struct GGGGC_Free *curFree;
-    struct GGGGC_Free *prevFree = NULL;
-    ggc_size_t *cur, tempSize;
-
-    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next) {
-        for (cur = poolCur->start; cur < poolCur->free; cur += tempSize) {
-            header = (struct GGGGC_Header *) cur;
-            header = UNMARK_PTR(struct GGGGC_Header, header);
-            if (IS_MARKED(header)) {
-                /*a marked object*/
-                UNMARK(header);
-                tempSize = header->descriptor__ptr->size;
-                if (tempSize == 1) {
-                    tempSize = 2;
-                }
-            } else if (IS_FREE((struct GGGGC_Free *) header)) {
-                /*already a free object*/
-                curFree = (struct GGGGC_Free *) header;
-                UNFREE(curFree);
-                curFree->next = prevFree;
-                tempSize = curFree->size;
-                prevFree = curFree;
-            } else {
-                /*a unmarked object, make it free*/
-                tempSize = header->descriptor__ptr->size;
-                if (tempSize == 1) {
-                    tempSize = 2;
-                }
-                curFree = (struct GGGGC_Free *) header;
-                curFree->size = tempSize;
-                curFree->next = prevFree;
-                prevFree = curFree;
-            }
-        }
-        poolCur->freeList = prevFree;
-    }
-}
-
-void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, /* descriptor to protect, if applicable */
-                      ggc_size_t size /* size of object to allocate */
-) {
-    struct GGGGC_Pool *pool, *newPool;
-    struct GGGGC_Header *ret;
-    size_t expand = FALSE;
-
-retry:
-    if (ggggc_pool) {
-        pool = ggggc_pool;
-    } else {
-        ggggc_rootPool = ggggc_pool = pool = ggggc_newPool(1);
-    }
-
-    if (size==1) {
-        size = 2;
-    }
-
-    /* check the free list of the pool in use, if there is enough space, we allocate the object there
-      * my thought is to use the global variable ggggc_pool here */
-    if (pool->freeList) {
-        /* check if there is enough space in the freelist */
-        struct GGGGC_Free *freeCur, *tempFree, *newFree;
-        /* the GGGGC_Free pointer temp is to store the previous GGGGC_Free of freeCur pointer, to assist making
-         * the free-list correct*/
-        struct GGGGC_Free *temp = NULL;
-        for (freeCur = pool->freeList; freeCur; freeCur = freeCur->next){
-            if (freeCur->size >= (sizeof(struct GGGGC_Free)/sizeof(ggc_size_t) + size)) {
-                ggc_size_t tempSize = freeCur->size;
-                tempFree = freeCur->next;
-                ret = (struct GGGGC_Header *) freeCur;
-
-                newFree = (struct GGGGC_Free *) ((ggc_size_t *) freeCur + size);
-                newFree->next = tempFree;
-                newFree->size = tempSize - size;
-                /* the space of the current free object on free list is sufficient to store the new object */
-                ret->descriptor__ptr=NULL;
-
-#ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
-                /* set its canary */
-            ret->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
-#endif
-
-                if (temp) {
-                    temp->next = newFree;
-                } else {
-                    pool->freeList = newFree;
-                }
-                /* and clear the rest (necessary since this goes to the untrusted mutator) */
-                memset(ret + 1, 0, size * sizeof(ggc_size_t) - sizeof(struct GGGGC_Header));
-                return ret;
-            } else if (freeCur->size == size) {
-                tempFree = FREED_OBJECT(freeCur);
-                ret = (struct GGGGC_Header *) freeCur;
-                ret->descriptor__ptr = NULL;
-#ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
-                /* set its canary */
-        		ret->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
-#endif
-
-                if (temp) {
-                    temp->next = tempFree;
-                } else {
-                    pool->freeList = tempFree;
-                }
-                /* and clear the rest (necessary since this goes to the untrusted mutator) */
-                memset(ret+1, 0,  size * sizeof(ggc_size_t) - sizeof(struct GGGGC_Header));
-                return ret;
-            }
-            temp = freeCur;
-        }
-    }
-
-    /* if there is not enough space in the free list, or the free list does not exist, then
-     * we move on to check the unused space in the pool */
-    if (pool->end - pool->free >= size) {
-        /* good, allocate here */
-        ret = (struct GGGGC_Header *) pool->free;
-        pool->free += size;
-
-        ret->descriptor__ptr = NULL;
-#ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
-        /* set its canary */
-        ret->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
-#endif
-
-        /* and clear the rest (necessary since this goes to the untrusted mutator) */
-        memset(ret + 1, 0, size * sizeof(ggc_size_t) - sizeof(struct GGGGC_Header));
-    } else if (pool->next) {
-        /* move to the next pool since the current pool don't have enough space to allocate the object*/
-        ggggc_pool = pool = pool->next;
-        goto retry;
-    } else {
-        /* a collection is needed since all the pools don't have enough space to allocate the object*/
-        /* we also create a new pool in this stage */
-        GGC_PUSH_1(*descriptor);
-        ggggc_collect0(0);
-        GGC_POP();
-        /* modified the ggggc_expandPoolList function in allocate.c slightly */
-        ggggc_expandPoolList(ggggc_rootPool, ggggc_newPool, 1, expand);
-        ggggc_pool = pool = ggggc_rootPool;
-        expand = TRUE;
-        goto retry;
-    }
-    return ret;
-}
-
-/* allocate an object */
-void *ggggc_malloc(struct GGGGC_Descriptor *descriptor)
-{
-    struct GGGGC_Header *ret = (struct GGGGC_Header *) ggggc_mallocRaw(&descriptor, descriptor->size);
-    ret->descriptor__ptr = descriptor;
-    return ret;
-}
-
-void ggggc_collect0(unsigned char gen)
-{
-    ggggc_markPhase();
-    ggggc_markAllFreeObjects();
-    ggggc_sweep();
-}
-
-int ggggc_yield()
-{
-    return 0;
-}
-
-#ifdef __cplusplus
-}
+/*
+ * Object allocation and the actual garbage collector
+ *
+ * Copyright (c) 2014, 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "ggggc/gc.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "ggggc-internals.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TRUE 1
+#define FALSE 0
+
+/* Since my final project is to build partition type GC, I decide to follow the TeSearchList in collector-gembc for
+ * marking. Each mark worker has its own stack of ToSearch chunks: it works
+ * from the top chunk alone, and pushes full chunks onto a locked list from
+ * which idle workers may steal */
+#define TOSEARCH_SZ 1024
+struct ToSearch {
+    struct ToSearch *next;
+    ggc_size_t used;
+    void *buf[TOSEARCH_SZ];
+};
+
+/* marking in parallel needs atomics and somewhere to run the workers */
+#if defined(__GNUC__) && !defined(GGGGC_NO_GNUC_FEATURES) && defined(GGGGC_THREADS_POSIX)
+#define PARALLEL_GC 1
+#define MAX_MARK_WORKERS 64
+#else
+#define MAX_MARK_WORKERS 1
+#endif
+
+#if defined(GGGGC_CONCURRENT_MARK) && !defined(PARALLEL_GC)
+#error GGGGC_CONCURRENT_MARK requires GNU C and POSIX threads
+#endif
+
+struct MarkWorker {
+    /* the chunk being worked on, private to this worker */
+    struct ToSearch *toSearch;
+
+    /* full chunks, available for stealing */
+    ggc_mutex_t lock;
+    struct ToSearch *full;
+
+    /* empty chunks, private */
+    struct ToSearch *spare;
+};
+
+static struct MarkWorker markWorkers[MAX_MARK_WORKERS];
+static ggc_size_t markWorkerCount;
+
+/* is marking running in parallel (and so needs atomic marks)? */
+static int markParallel;
+
+/* how many workers are marking (or trying to steal), and how many are idle */
+static volatile ggc_size_t markBusy, markIdle;
+
+/* get an empty chunk for a worker */
+static struct ToSearch *newChunk(struct MarkWorker *w)
+{
+    struct ToSearch *ret = w->spare;
+    if (ret) {
+        w->spare = ret->next;
+    } else {
+        ret = (struct ToSearch *) malloc(sizeof(struct ToSearch));
+        if (ret == NULL) {
+            /* FIXME: handle somehow? */
+            perror("malloc");
+            abort();
+        }
+    }
+    ret->next = NULL;
+    ret->used = 0;
+    return ret;
+}
+
+/* make a chunk available for stealing */
+static void shareChunk(struct MarkWorker *w, struct ToSearch *chunk)
+{
+    ggc_mutex_lock_raw(&w->lock);
+    chunk->next = w->full;
+    w->full = chunk;
+    ggc_mutex_unlock(&w->lock);
+}
+
+/* replace a worker's empty current chunk with a full one */
+static void takeChunk(struct MarkWorker *w, struct ToSearch *chunk)
+{
+    w->toSearch->next = w->spare;
+    w->spare = w->toSearch;
+    w->toSearch = chunk;
+}
+
+/* take a full chunk from a worker's list (the worker's own, or a victim's) */
+static struct ToSearch *popChunk(struct MarkWorker *from)
+{
+    struct ToSearch *ret;
+    if (!from->full) return NULL;
+    ggc_mutex_lock_raw(&from->lock);
+    if ((ret = from->full))
+        from->full = ret->next;
+    ggc_mutex_unlock(&from->lock);
+    return ret;
+}
+
+/* give the older half of our current chunk to idle workers */
+static void splitChunk(struct MarkWorker *w)
+{
+    struct ToSearch *chunk = newChunk(w), *cur = w->toSearch;
+    ggc_size_t half = cur->used / 2;
+    memcpy(chunk->buf, cur->buf, half * sizeof(void *));
+    memmove(cur->buf, cur->buf + half, (cur->used - half) * sizeof(void *));
+    chunk->used = half;
+    cur->used -= half;
+    shareChunk(w, chunk);
+}
+
+#define TOSEARCH_ADD(w, ptr) do { \
+    if ((w)->toSearch->used >= TOSEARCH_SZ) { \
+        shareChunk((w), (w)->toSearch); \
+        (w)->toSearch = newChunk(w); \
+    } \
+    (w)->toSearch->buf[(w)->toSearch->used++] = (ptr); \
+} while(0)
+
+/* the mutator may store tagged non-pointers (e.g. small ints) in pointer
+ * slots, which are never objects */
+#define IS_TAGGED(ptr) ((ggc_size_t) (ptr) & (sizeof(ggc_size_t)-1))
+/* macro to add the addresses of an object's pointers to a worker's tosearch
+ * list, for a minor collection, which must update them */
+#define ADD_OBJECT_POINTERS(w, obj, descriptor) do { \
+    void **objVp = (void **) (obj); \
+    ggc_size_t curWord; \
+    GGGGC_FOR_EACH_POINTER(descriptor, curWord, \
+        if (!IS_TAGGED(objVp[curWord])) \
+            TOSEARCH_ADD(w, &objVp[curWord]); \
+    ); \
+    TOSEARCH_ADD(w, &objVp[0]); \
+} while(0)
+
+/* macro to add the objects an object refers to (including its descriptor) to
+ * a worker's tosearch list, for marking. Unlike ADD_OBJECT_POINTERS, this adds
+ * the objects themselves, skipping NULLs and anything known to be marked */
+#define ADD_OBJECT_REFERENTS(w, obj, descriptor) do { \
+    void **objVp = (void **) (obj); \
+    void *referent; \
+    ggc_size_t curWord; \
+    GGGGC_FOR_EACH_POINTER(descriptor, curWord, \
+        if ((referent = objVp[curWord]) && !IS_TAGGED(referent) && \
+            !IS_KNOWN_MARKED((struct GGGGC_Header *) referent)) \
+            TOSEARCH_ADD(w, referent); \
+    ); \
+    if (!IS_KNOWN_MARKED((struct GGGGC_Header *) descriptor)) \
+        TOSEARCH_ADD(w, descriptor); \
+} while(0)
+
+
+#ifdef GGGGC_USE_MARK_BITMAP
+/* the bit for an object within its pool's bitmap */
+#define MARK_INDEX(obj) (((ggc_size_t) (obj) & GGGGC_POOL_INNER_MASK) / sizeof(ggc_size_t))
+#define MARK_WORD(obj) (GGGGC_POOL_OF(obj)->markBits[MARK_INDEX(obj) / GGGGC_BITS_PER_WORD])
+#define MARK_BIT(obj) ((ggc_size_t) 1 << (MARK_INDEX(obj) % GGGGC_BITS_PER_WORD))
+
+/* mark an object */
+#define MARK(obj) do { \
+    struct GGGGC_Header *hobj = (obj); \
+    MARK_WORD(hobj) |= MARK_BIT(hobj); \
+} while (0)
+
+/* unmark an object */
+#define UNMARK(obj) do { \
+    struct GGGGC_Header *hobj = (obj); \
+    MARK_WORD(hobj) &= ~MARK_BIT(hobj); \
+} while (0)
+
+/* pointers are never marked */
+#define UNMARK_PTR(type, ptr) ((type *) (ptr))
+
+/* is this object marked? */
+#define IS_MARKED(obj) (MARK_WORD(obj) & MARK_BIT(obj))
+
+/* is this object marked, as far as can be told cheaply? The bitmap is much
+ * denser than the objects, so is worth checking before adding one to search */
+#define IS_KNOWN_MARKED(obj) IS_MARKED(obj)
+
+/* fetch what marking an object will read */
+#define PREFETCH_OBJECT(obj) do { \
+    GGGGC_PREFETCH(obj); \
+    GGGGC_PREFETCH(&MARK_WORD(obj)); \
+} while (0)
+
+/* mark an object if it isn't already, returning true if this call marked it */
+static int tryMark(struct GGGGC_Header *obj)
+{
+    if (IS_MARKED(obj)) return FALSE;
+#ifdef PARALLEL_GC
+    if (markParallel)
+        return !(__sync_fetch_and_or(&MARK_WORD(obj), MARK_BIT(obj)) & MARK_BIT(obj));
+#endif
+    MARK(obj);
+    return TRUE;
+}
+
+#else
+/* mark an object */
+#define MARK(obj) do { \
+    struct GGGGC_Header *hobj = (obj); \
+    hobj->descriptor__ptr = (struct GGGGC_Descriptor *) \
+        ((ggc_size_t) hobj->descriptor__ptr | (ggc_size_t) 1); \
+} while (0)
+
+/* unmark a pointer */
+#define UNMARK_PTR(type, ptr) \
+    ((type *) ((ggc_size_t) (ptr) & (ggc_size_t) ~1))
+
+/* get an object's descriptor, through markers */
+#define MARKED_DESCRIPTOR(obj) \
+    (UNMARK_PTR(struct GGGGC_Descriptor, (obj)->descriptor__ptr))
+
+/* unmark an object */
+#define UNMARK(obj) do { \
+    struct GGGGC_Header *hobj = (obj); \
+    hobj->descriptor__ptr = UNMARK_PTR(struct GGGGC_Descriptor, hobj->descriptor__ptr); \
+} while (0)
+
+/* is this pointer marked? */
+#define IS_MARKED_PTR(ptr) ((ggc_size_t) (ptr) & 1)
+
+/* is this object marked? */
+#define IS_MARKED(obj) IS_MARKED_PTR((obj)->descriptor__ptr)
+
+/* checking the mark in the header would take the very cache miss that
+ * prefetching in markChunks hides, so it's left until the object is marked */
+#define IS_KNOWN_MARKED(obj) FALSE
+
+/* fetch what marking an object will read */
+#define PREFETCH_OBJECT(obj) GGGGC_PREFETCH(obj)
+
+/* mark an object if it isn't already, returning true if this call marked it */
+static int tryMark(struct GGGGC_Header *obj)
+{
+    struct GGGGC_Descriptor *descriptor = obj->descriptor__ptr;
+    if (IS_MARKED_PTR(descriptor)) return FALSE;
+#ifdef PARALLEL_GC
+    /* the mark bit is the only thing that can change under us */
+    if (markParallel)
+        return __sync_bool_compare_and_swap(&obj->descriptor__ptr, descriptor,
+            (struct GGGGC_Descriptor *) ((ggc_size_t) descriptor | 1));
+#endif
+    MARK(obj);
+    return TRUE;
+}
+
+#endif
+
+
+/* free an object */
+#define FREE(obj) do { \
+    struct GGGGC_Free *fobj = (obj); \
+    fobj->next = (struct GGGGC_Free *) \
+        ((ggc_size_t) fobj->next | 2); \
+} while (0)
+
+/* get a free object's next object, through markers */
+#define FREED_OBJECT(obj) \
+    (UNFREE_PTR(struct GGGGC_FREE, (obj)->next))
+
+/* unfree a pointer*/
+#define UNFREE_PTR(type, ptr) \
+    ((type *) ((ggc_size_t) (ptr) & (ggc_size_t) ~2))
+
+#define UNFREE(obj) do { \
+    struct GGGGC_Free *fobj = (obj); \
+    fobj->next = UNFREE_PTR(struct GGGGC_Free, fobj->next); \
+} while (0)
+
+#define IS_FREE_PTR(ptr) ((ggc_size_t) (ptr) & 2)
+
+#define IS_FREE(obj) IS_FREE_PTR((obj)->next)
+
+/* look for work in other workers' lists, returning false once there's none
+ * left anywhere */
+static int findWork(struct MarkWorker *w)
+{
+#ifdef PARALLEL_GC
+    struct ToSearch *chunk;
+    ggc_size_t i;
+
+    if (markWorkerCount == 1) return FALSE;
+
+    __sync_fetch_and_sub(&markBusy, 1);
+    __sync_fetch_and_add(&markIdle, 1);
+
+    /* only busy workers make work, so once none are busy, we're done */
+    while (markBusy) {
+        for (i = 1; i < markWorkerCount; i++) {
+            struct MarkWorker *victim = &markWorkers[(w - markWorkers + i) % markWorkerCount];
+            if (!victim->full) continue;
+            __sync_fetch_and_add(&markBusy, 1);
+            if ((chunk = popChunk(victim))) {
+                __sync_fetch_and_sub(&markIdle, 1);
+                takeChunk(w, chunk);
+                return TRUE;
+            }
+            __sync_fetch_and_sub(&markBusy, 1);
+        }
+        sched_yield();
+    }
+#endif
+
+    return FALSE;
+}
+
+/* mark an object if it isn't already, and add its pointers to a worker's
+ * to-search list */
+static void markObject(struct MarkWorker *w, struct GGGGC_Header *obj)
+{
+    struct GGGGC_Descriptor *descriptor;
+
+    if (!tryMark(obj)) return;
+    descriptor = UNMARK_PTR(struct GGGGC_Descriptor, obj->descriptor__ptr);
+#ifdef PARALLEL_GC
+    if (markParallel)
+        __sync_fetch_and_add(&GGGGC_POOL_OF(obj)->survivors, descriptor->size);
+    else
+#endif
+    GGGGC_POOL_OF(obj)->survivors += descriptor->size;
+
+    ADD_OBJECT_REFERENTS(w, obj, descriptor);
+}
+
+/* objects taken from the to-search list wait in a small FIFO while what
+ * marking them reads is prefetched, so that each cache miss overlaps with
+ * marking the objects ahead of it */
+#ifndef GGGGC_MARK_PREFETCH
+#define GGGGC_MARK_PREFETCH 8
+#endif
+
+/* mark from a worker's own to-search list until it's empty, or until *stop is
+ * set (if stop is given) */
+static void markChunks(struct MarkWorker *w, volatile int *stop)
+{
+    struct ToSearch *chunk;
+    struct GGGGC_Header *obj, *next, *fifo[GGGGC_MARK_PREFETCH];
+    ggc_size_t head = 0, count = 0;
+
+    while (!stop || !*stop) {
+        if (!w->toSearch->used && (chunk = popChunk(w)))
+            takeChunk(w, chunk);
+
+        if (w->toSearch->used) {
+            next = (struct GGGGC_Header *) w->toSearch->buf[--w->toSearch->used];
+            PREFETCH_OBJECT(next);
+            if (count < GGGGC_MARK_PREFETCH) {
+                fifo[(head + count++) % GGGGC_MARK_PREFETCH] = next;
+                continue;
+            }
+
+            /* the FIFO is full, so the next one replaces the oldest */
+            obj = fifo[head];
+            fifo[head] = next;
+            head = (head + 1) % GGGGC_MARK_PREFETCH;
+        } else if (count) {
+            obj = fifo[head];
+            head = (head + 1) % GGGGC_MARK_PREFETCH;
+            count--;
+        } else {
+            break;
+        }
+
+        markObject(w, obj);
+
+        /* if others are waiting for work, share some */
+        if (markIdle && !w->full && w->toSearch->used >= 2)
+            splitChunk(w);
+    }
+
+    /* if stopped, put back what was waiting */
+    while (count) {
+        TOSEARCH_ADD(w, fifo[head]);
+        head = (head + 1) % GGGGC_MARK_PREFETCH;
+        count--;
+    }
+}
+
+/* mark everything reachable from a worker's to-search list */
+static void markLoop(struct MarkWorker *w)
+{
+    do {
+        markChunks(w, NULL);
+    } while (findWork(w));
+}
+
+#ifdef PARALLEL_GC
+/* helper workers wait here for each parallel phase (marking or sweeping), then
+ * run workerTask */
+static ggc_sem_t workerStart;
+static ggc_barrier_t workerDone;
+static void (*workerTask)(struct MarkWorker *w);
+
+static void *markWorkerThread(void *arg)
+{
+    struct MarkWorker *w = (struct MarkWorker *) arg;
+    while (1) {
+        ggc_sem_wait_raw(&workerStart);
+        workerTask(w);
+        ggc_barrier_wait_raw(&workerDone);
+    }
+    return NULL;
+}
+#endif
+
+/* set up the workers, the first time we mark or sweep. The number of workers
+ * is taken from GGGGC_MARK_THREADS, or is the number of processors */
+static void initMarkWorkers()
+{
+    ggc_size_t i;
+#ifdef PARALLEL_GC
+    const char *env;
+    long count;
+    pthread_t th;
+
+    if ((env = getenv("GGGGC_MARK_THREADS")))
+        count = atol(env);
+    else
+        count = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count < 1) count = 1;
+    if (count > MAX_MARK_WORKERS) count = MAX_MARK_WORKERS;
+    markWorkerCount = count;
+#else
+    markWorkerCount = 1;
+#endif
+
+    for (i = 0; i < markWorkerCount; i++) {
+        ggc_mutex_t lock = GGC_MUTEX_INITIALIZER;
+        markWorkers[i].lock = lock;
+        markWorkers[i].toSearch = newChunk(&markWorkers[i]);
+    }
+
+#ifdef PARALLEL_GC
+    if (markWorkerCount > 1) {
+        ggc_sem_init(&workerStart, 0);
+        ggc_barrier_init(&workerDone, markWorkerCount);
+        for (i = 1; i < markWorkerCount; i++) {
+            if ((errno = pthread_create(&th, NULL, markWorkerThread, &markWorkers[i]))) {
+                perror("pthread_create");
+                abort();
+            }
+            pthread_detach(th);
+        }
+    }
+#endif
+}
+
+/* run a task on every worker, with this thread as worker 0 */
+static void runWorkers(void (*task)(struct MarkWorker *w))
+{
+#ifdef PARALLEL_GC
+    ggc_size_t i;
+
+    workerTask = task;
+    for (i = 1; i < markWorkerCount; i++)
+        ggc_sem_post(&workerStart);
+#endif
+    task(&markWorkers[0]);
+#ifdef PARALLEL_GC
+    if (markWorkerCount > 1)
+        ggc_barrier_wait_raw(&workerDone);
+#endif
+}
+
+void ggggc_markPhase()
+{
+    struct GGGGC_PointerStackList *pslCur;
+    struct GGGGC_JITPointerStackList *jpslCur;
+    struct GGGGC_PointerStack *psCur;
+    struct MarkWorker *w;
+    void **jpsCur, *obj;
+    ggc_size_t i;
+
+    if (!markWorkerCount) initMarkWorkers();
+    w = &markWorkers[0];
+    ggggc_collectionPhase(GGGGC_PHASE_ROOTS);
+
+    /* add every thread's roots to the to-search list */
+    for (pslCur = ggggc_rootPointerStackList; pslCur; pslCur = pslCur->next) {
+        for (psCur = pslCur->pointerStack; psCur; psCur = psCur->next) {
+            for (i = 0; i < psCur->size; i++) {
+                obj = *(void **) psCur->pointers[i];
+                if (obj && !IS_TAGGED(obj))
+                    TOSEARCH_ADD(w, obj);
+            }
+        }
+    }
+    for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
+        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++) {
+            obj = *jpsCur;
+            if (obj && !IS_TAGGED(obj))
+                TOSEARCH_ADD(w, obj);
+        }
+    }
+
+    /* The marking phase, with the helpers (if any) stealing roots from us */
+    ggggc_collectionPhase(GGGGC_PHASE_MARK);
+    markBusy = markWorkerCount;
+    markIdle = 0;
+    markParallel = (markWorkerCount > 1);
+    runWorkers(markLoop);
+}
+
+#ifdef GGGGC_CONCURRENT_MARK
+/* a concurrent mark runs from an initial pause, in which the roots are shaded,
+ * to a remark pause, in which the SATB buffers are drained. Between them, the
+ * marker thread traces as worker 0, and everything allocated is marked */
+static int concActive;
+
+/* set to ask the marker to stop, and by the marker when it runs out of work */
+static volatile int concStop, concDone;
+
+/* the marker waits for concStart, and posts concFinished when it stops */
+static int concStarted;
+static ggc_sem_t concStart, concFinished;
+
+/* before a mark starts, the marker sweeps the pools the allocator hasn't
+ * reached, so that the initial pause needn't, and their garbage is free to
+ * allocate into during the mark. concSweeping is set while it does (protected
+ * by ggggc_allocLock), and concSweepDone by the marker when it's done */
+static int concSweeping;
+static volatile int concSweepDone;
+
+/* full SATB buffers, waiting for the marker */
+static ggc_mutex_t satbLock = GGC_MUTEX_INITIALIZER;
+static struct ToSearch *volatile satbFull;
+
+/* pools allocated through since the last collection */
+static ggc_size_t poolsUsed;
+
+void ggggc_retireSATB()
+{
+    struct ToSearch *chunk = (struct ToSearch *) ggggc_satbBuffer;
+
+    if (!chunk) return;
+    chunk->used = ggggc_satbCur - chunk->buf;
+    if (chunk->used) {
+        ggc_mutex_lock_raw(&satbLock);
+        chunk->next = satbFull;
+        satbFull = chunk;
+        ggc_mutex_unlock(&satbLock);
+    } else {
+        free(chunk);
+    }
+    ggggc_satbBuffer = NULL;
+    ggggc_satbCur = ggggc_satbEnd = NULL;
+}
+
+void ggggc_satbFlush()
+{
+    struct ToSearch *chunk;
+
+    ggggc_retireSATB();
+    chunk = (struct ToSearch *) malloc(sizeof(struct ToSearch));
+    if (chunk == NULL) {
+        /* FIXME: handle somehow? */
+        perror("malloc");
+        abort();
+    }
+    ggggc_satbBuffer = chunk;
+    ggggc_satbCur = chunk->buf;
+    ggggc_satbEnd = chunk->buf + TOSEARCH_SZ;
+}
+
+/* take a full SATB buffer, if there are any */
+static struct ToSearch *takeSATB()
+{
+    struct ToSearch *ret;
+    if (!satbFull) return NULL;
+    ggc_mutex_lock_raw(&satbLock);
+    if ((ret = satbFull))
+        satbFull = ret->next;
+    ggc_mutex_unlock(&satbLock);
+    return ret;
+}
+
+/* mark everything logged in an SATB buffer, then free it */
+static void markSATB(struct MarkWorker *w, struct ToSearch *chunk)
+{
+    ggc_size_t i;
+    for (i = 0; i < chunk->used; i++)
+        markObject(w, (struct GGGGC_Header *) chunk->buf[i]);
+    free(chunk);
+}
+
+/* mark the objects the roots refer to, rather than the roots themselves,
+ * since the mutator will change them while we mark */
+static void shadeRoots(struct MarkWorker *w)
+{
+    struct GGGGC_PointerStackList *pslCur;
+    struct GGGGC_JITPointerStackList *jpslCur;
+    struct GGGGC_PointerStack *psCur;
+    void **jpsCur, *obj;
+    ggc_size_t i;
+
+    for (pslCur = ggggc_rootPointerStackList; pslCur; pslCur = pslCur->next) {
+        for (psCur = pslCur->pointerStack; psCur; psCur = psCur->next) {
+            for (i = 0; i < psCur->size; i++) {
+                obj = *(void **) psCur->pointers[i];
+                if (obj && !IS_TAGGED(obj))
+                    markObject(w, (struct GGGGC_Header *) obj);
+            }
+        }
+    }
+    for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
+        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++) {
+            obj = *jpsCur;
+            if (obj && !IS_TAGGED(obj))
+                markObject(w, (struct GGGGC_Header *) obj);
+        }
+    }
+}
+
+/* the background marker */
+static void *concMarkThread(void *arg)
+{
+    struct MarkWorker *w = &markWorkers[0];
+    struct ToSearch *chunk;
+    struct GGGGC_Pool *pool;
+
+    while (1) {
+        ggc_sem_wait_raw(&concStart);
+        if (concSweeping) {
+            /* the allocator may get to a pool first, so take them one by one */
+            for (pool = ggggc_rootPool; pool && !concStop; pool = pool->next) {
+                ggc_mutex_lock_raw(&ggggc_allocLock);
+                if (!pool->swept)
+                    ggggc_sweepPool(pool);
+                ggc_mutex_unlock(&ggggc_allocLock);
+            }
+            concSweepDone = TRUE;
+            ggc_sem_post(&concFinished);
+            continue;
+        }
+
+        while (!concStop) {
+            markChunks(w, &concStop);
+            if (concStop || !(chunk = takeSATB())) break;
+            markSATB(w, chunk);
+        }
+
+        /* anything logged from here on is left to the remark */
+        concDone = TRUE;
+        ggc_sem_post(&concFinished);
+    }
+    return NULL;
+}
+
+/* finish a concurrent mark, with the world stopped */
+static void remark()
+{
+    struct MarkWorker *w = &markWorkers[0];
+    struct ToSearch *chunk;
+
+    /* take worker 0 back from the marker */
+    ggggc_collectionPhase(GGGGC_PHASE_MARK);
+    concStop = TRUE;
+    ggc_sem_wait_raw(&concFinished);
+    ggggc_concurrentMarking = 0;
+
+    /* then drain the SATB buffers and whatever the marker left, in parallel */
+    markParallel = (markWorkerCount > 1);
+    while ((chunk = takeSATB()))
+        markSATB(w, chunk);
+    markBusy = markWorkerCount;
+    markIdle = 0;
+    runWorkers(markLoop);
+
+    concActive = FALSE;
+}
+#endif
+
+#ifndef GGGGC_USE_MARK_BITMAP
+/* mark every chunk on a free list as free */
+static void markFreeList(struct GGGGC_Free *curFree)
+{
+    struct GGGGC_Free *tempFree;
+
+    while (curFree) {
+        tempFree = curFree->next;
+        FREE(curFree);
+        curFree = tempFree;
+    }
+}
+
+void ggggc_markAllFreeObjects(struct GGGGC_Pool *pool)
+{
+    struct GGGGC_FreeNode *node, *tempNode;
+    ggc_size_t i;
+
+    for (i = 0; i < GGGGC_FREE_CLASSES; i++) {
+        markFreeList(pool->freeLists[i]);
+        pool->freeLists[i] = NULL;
+    }
+
+    /* the tree is thrown away by the sweep, so flatten it as we go rather
+     * than keeping a stack */
+    node = pool->freeTree;
+    while (node) {
+        if (node->left) {
+            tempNode = node->left;
+            node->left = tempNode->right;
+            tempNode->right = node;
+            node = tempNode;
+        } else {
+            tempNode = node->right;
+            markFreeList(&node->chunk);
+            node = tempNode;
+        }
+    }
+    pool->freeTree = NULL;
+}
+#endif
+
+/* add a chunk of free space to a pool's free lists */
+static void addFree(struct GGGGC_Pool *pool, ggc_size_t *start, ggc_size_t size)
+{
+    struct GGGGC_Free *chunk = (struct GGGGC_Free *) start;
+    struct GGGGC_FreeNode *node, **link;
+
+    chunk->size = size;
+    if (size < GGGGC_FREE_CLASSES) {
+        chunk->next = pool->freeLists[size];
+        pool->freeLists[size] = chunk;
+        return;
+    }
+
+    /* find its place in the tree */
+    link = &pool->freeTree;
+    while ((node = *link)) {
+        if (node->chunk.size == size) {
+            /* same size, just chain it */
+            chunk->next = node->chunk.next;
+            node->chunk.next = chunk;
+            return;
+        }
+        link = (size < node->chunk.size) ? &node->left : &node->right;
+    }
+    node = (struct GGGGC_FreeNode *) chunk;
+    node->chunk.next = NULL;
+    node->left = node->right = NULL;
+    *link = node;
+}
+
+/* remove the best fit for an object of the given size from a pool's free tree.
+ * A fit is either exact or leaves room for a free chunk behind it */
+static struct GGGGC_Free *takeFreeTree(struct GGGGC_Pool *pool, ggc_size_t size)
+{
+    struct GGGGC_FreeNode *node, *best = NULL, **link, **bestLink = NULL, *min, **minLink;
+    struct GGGGC_Free *ret;
+
+    link = &pool->freeTree;
+    while ((node = *link)) {
+        if (node->chunk.size == size) {
+            best = node;
+            bestLink = link;
+            break;
+        } else if (node->chunk.size >= size + GGGGC_WORD_SIZEOF(struct GGGGC_Free)) {
+            /* fits, but maybe there's something tighter */
+            best = node;
+            bestLink = link;
+            link = &node->left;
+        } else {
+            link = &node->right;
+        }
+    }
+    if (!best) return NULL;
+
+    /* prefer taking from the chain, so the tree needn't change */
+    if (best->chunk.next) {
+        ret = best->chunk.next;
+        best->chunk.next = ret->next;
+        return ret;
+    }
+
+    /* unlink the node itself */
+    if (!best->left) {
+        *bestLink = best->right;
+    } else if (!best->right) {
+        *bestLink = best->left;
+    } else {
+        /* replace it with the smallest node to its right */
+        minLink = &best->right;
+        while ((*minLink)->left) minLink = &(*minLink)->left;
+        min = *minLink;
+        *minLink = min->right;
+        min->left = best->left;
+        min->right = best->right;
+        *bestLink = min;
+    }
+    return &best->chunk;
+}
+
+/* allocate from a pool's free lists, or return NULL if nothing fits. Up to
+ * *got words (at least size) are taken if the chunk found has them, and *got is
+ * set to the number actually taken */
+static void *allocFree(struct GGGGC_Pool *pool, ggc_size_t size, ggc_size_t *got)
+{
+    struct GGGGC_Free *ret = NULL;
+    ggc_size_t i, freeSize;
+
+    if (size < GGGGC_FREE_CLASSES) {
+        /* an exact fit is the common case */
+        if ((ret = pool->freeLists[size])) {
+            pool->freeLists[size] = ret->next;
+            *got = size;
+            return ret;
+        }
+
+        /* otherwise split the smallest class that leaves a usable remainder */
+        for (i = size + GGGGC_WORD_SIZEOF(struct GGGGC_Free); i < GGGGC_FREE_CLASSES; i++) {
+            if ((ret = pool->freeLists[i])) {
+                pool->freeLists[i] = ret->next;
+                break;
+            }
+        }
+    }
+
+    if (!ret && !(ret = takeFreeTree(pool, size)))
+        return NULL;
+
+    /* give back whatever we didn't use, so long as it can be a chunk */
+    freeSize = ret->size;
+    if (freeSize >= *got + GGGGC_WORD_SIZEOF(struct GGGGC_Free))
+        addFree(pool, (ggc_size_t *) ret + *got, freeSize - *got);
+    else
+        *got = freeSize;
+    return ret;
+}
+
+#ifdef GGGGC_USE_MARK_BITMAP
+void ggggc_sweepPool(struct GGGGC_Pool *pool)
+{
+    struct GGGGC_Header *header;
+    struct GGGGC_Free *runs = NULL, *run;
+    ggc_size_t *cur, *live, bits, wordI, firstWord, endWord, tempSize;
+    ggc_size_t liveWords = 0, freeWords = 0, largest;
+
+    /* the free lists are rebuilt from scratch */
+    memset(pool->freeLists, 0, sizeof(pool->freeLists));
+    pool->freeTree = NULL;
+
+    /* everything between one live object and the next marked one is free, so
+     * only live objects are ever touched */
+    cur = pool->start;
+    firstWord = MARK_INDEX(pool->start) / GGGGC_BITS_PER_WORD;
+    endWord = (MARK_INDEX(pool->free - 1) + GGGGC_BITS_PER_WORD) / GGGGC_BITS_PER_WORD;
+    for (wordI = firstWord; wordI < endWord; wordI++) {
+        for (bits = pool->markBits[wordI]; bits; bits &= bits - 1) {
+            live = (ggc_size_t *) pool + wordI * GGGGC_BITS_PER_WORD + GGGGC_CTZ(bits);
+            if (live > cur) {
+                run = (struct GGGGC_Free *) cur;
+                run->next = runs;
+                run->size = live - cur;
+                runs = run;
+                freeWords += run->size;
+            }
+            header = (struct GGGGC_Header *) live;
+            tempSize = header->descriptor__ptr->size;
+            if (tempSize == 1) {
+                tempSize = 2;
+            }
+            liveWords += tempSize;
+            cur = live + tempSize;
+        }
+    }
+
+    /* free space at the end of the pool just goes back to the bump region */
+    pool->free = cur;
+
+#ifdef GGGGC_GENERATIONAL
+    /* the marks stay, as the starts of objects for scanning dirty cards */
+#else
+    /* and all the marks go at once */
+    memset(pool->markBits + firstWord, 0, (endWord - firstWord) * sizeof(ggc_size_t));
+#endif
+
+    largest = pool->end - pool->free;
+    while (runs) {
+        run = runs;
+        runs = run->next;
+        if (run->size > largest) largest = run->size;
+        addFree(pool, (ggc_size_t *) run, run->size);
+    }
+
+    pool->liveBytes = liveWords * sizeof(ggc_size_t);
+    pool->freeBytes = (freeWords + (pool->end - pool->free)) * sizeof(ggc_size_t);
+    pool->largestFree = largest * sizeof(ggc_size_t);
+    pool->swept = 1;
+}
+
+#else
+/* is this object a descriptor? Descriptor-descriptors are unique per size */
+#define IS_DESCRIPTOR(obj) \
+    ((obj)->descriptor__ptr->size < GGGGC_DESCRIPTOR_DESCRIPTORS && \
+     ggggc_descriptorDescriptors[(obj)->descriptor__ptr->size] == (obj)->descriptor__ptr)
+
+/* pools marked but not yet swept, and dead descriptors that must outlive them.
+ * Dead objects in an unswept pool still need the size in their (possibly dead)
+ * descriptor, so dead descriptors aren't freed until every pool is swept. They
+ * are linked through user__ptr. Pools may be swept in parallel, so each sweep
+ * gathers its own dead descriptors and hands them over when it's done */
+static volatile ggc_size_t unsweptPools;
+static struct GGGGC_Descriptor *volatile deadDescriptors;
+
+/* free the dead descriptors once nothing can need them */
+static void freeDeadDescriptors()
+{
+    struct GGGGC_Descriptor *cur, *next;
+
+    for (cur = deadDescriptors; cur; cur = next) {
+        next = (struct GGGGC_Descriptor *) cur->user__ptr;
+        GGGGC_POOL_OF(cur)->freeBytes += cur->header.descriptor__ptr->size * sizeof(ggc_size_t);
+        addFree(GGGGC_POOL_OF(cur), (ggc_size_t *) cur, cur->header.descriptor__ptr->size);
+    }
+    deadDescriptors = NULL;
+}
+
+/* hand a swept pool's dead descriptors over, freeing them all if this was the
+ * last pool to be swept */
+static void finishSweepPool(struct GGGGC_Descriptor *dead, struct GGGGC_Descriptor *deadTail)
+{
+#ifdef PARALLEL_GC
+    if (markWorkerCount > 1) {
+        struct GGGGC_Descriptor *head;
+        if (dead) {
+            do {
+                head = deadDescriptors;
+                deadTail->user__ptr = head;
+            } while (!__sync_bool_compare_and_swap(&deadDescriptors, head, dead));
+        }
+        if (__sync_sub_and_fetch(&unsweptPools, 1) == 0)
+            freeDeadDescriptors();
+        return;
+    }
+#endif
+
+    if (dead) {
+        deadTail->user__ptr = deadDescriptors;
+        deadDescriptors = dead;
+    }
+    if (--unsweptPools == 0)
+        freeDeadDescriptors();
+}
+
+void ggggc_sweepPool(struct GGGGC_Pool *pool)
+{
+    struct GGGGC_Header *header;
+    struct GGGGC_Free *runs = NULL, *run;
+    struct GGGGC_Descriptor *dead = NULL, *deadTail = NULL;
+    ggc_size_t *cur, *runStart = NULL, tempSize;
+    ggc_size_t liveWords = 0, freeWords = 0, largest;
+
+    ggggc_markAllFreeObjects(pool);
+
+    for (cur = pool->start; cur < pool->free; cur += tempSize) {
+        header = (struct GGGGC_Header *) cur;
+        if (IS_MARKED(header)) {
+            /*a marked object*/
+            UNMARK(header);
+            tempSize = header->descriptor__ptr->size;
+            if (tempSize == 1) {
+                tempSize = 2;
+            }
+            liveWords += tempSize;
+
+        } else if (IS_FREE((struct GGGGC_Free *) header)) {
+            /*already a free object*/
+            tempSize = ((struct GGGGC_Free *) header)->size;
+            if (!runStart) runStart = cur;
+            continue;
+
+        } else if (IS_DESCRIPTOR(header)) {
+            /*a dead descriptor, keep it until the sweep is finished*/
+            tempSize = header->descriptor__ptr->size;
+            ((struct GGGGC_Descriptor *) header)->user__ptr = dead;
+            dead = (struct GGGGC_Descriptor *) header;
+            if (!deadTail) deadTail = dead;
+
+        } else {
+            /*a unmarked object, make it free*/
+            tempSize = header->descriptor__ptr->size;
+            if (tempSize == 1) {
+                tempSize = 2;
+            }
+            /* coalesce it with its free neighbors */
+            if (!runStart) runStart = cur;
+            continue;
+
+        }
+
+        /* a kept object ends any run of free space */
+        if (runStart) {
+            run = (struct GGGGC_Free *) runStart;
+            run->next = runs;
+            run->size = cur - runStart;
+            runs = run;
+            freeWords += run->size;
+            runStart = NULL;
+        }
+    }
+
+    /* free space at the end of the pool just goes back to the bump region */
+    if (runStart)
+        pool->free = runStart;
+
+    /* the runs were found last-first, so this leaves the lists in address
+     * order, which allocates noticeably faster */
+    largest = pool->end - pool->free;
+    while (runs) {
+        run = runs;
+        runs = run->next;
+        if (run->size > largest) largest = run->size;
+        addFree(pool, (ggc_size_t *) run, run->size);
+    }
+
+    pool->liveBytes = liveWords * sizeof(ggc_size_t);
+    pool->freeBytes = (freeWords + (pool->end - pool->free)) * sizeof(ggc_size_t);
+    pool->largestFree = largest * sizeof(ggc_size_t);
+    pool->swept = 1;
+    finishSweepPool(dead, deadTail);
+}
+#endif
+
+/* pools not yet claimed by a sweep worker */
+static struct GGGGC_Pool *volatile sweepCursor;
+
+/* sweep pools until there are none left to claim. Each pool's sweep touches
+ * only that pool, so workers need share nothing else */
+static void sweepLoop(struct MarkWorker *w)
+{
+    struct GGGGC_Pool *pool;
+
+    while ((pool = sweepCursor)) {
+#ifdef PARALLEL_GC
+        if (markWorkerCount > 1) {
+            if (!__sync_bool_compare_and_swap(&sweepCursor, pool, pool->next))
+                continue;
+        } else
+#endif
+        sweepCursor = pool->next;
+
+        if (!pool->swept)
+            ggggc_sweepPool(pool);
+    }
+}
+
+void ggggc_sweep()
+{
+    struct GGGGC_Pool *poolCur;
+
+    /* don't wake the workers for nothing */
+    for (poolCur = ggggc_rootPool; poolCur && poolCur->swept; poolCur = poolCur->next);
+    if (!poolCur) return;
+
+    if (!markWorkerCount) initMarkWorkers();
+    sweepCursor = poolCur;
+    runWorkers(sweepLoop);
+}
+
+/* allocate a pool for the shared (old) heap */
+static struct GGGGC_Pool *newOldPool(void)
+{
+    struct GGGGC_Pool *ret = ggggc_newPool(1);
+#ifdef GGGGC_GENERATIONAL
+    ret->gen = 1;
+#endif
+    return ret;
+}
+
+/* set when an allocation has failed even after a collection, so the next
+ * collection must grow the heap, or when the embedder has asked for it to be
+ * trimmed. Protected by ggggc_allocLock */
+static int mustGrow, trimHeap;
+
+/* words allocated since the last collection, for the statistics. TLABs count
+ * when they're taken, less what's left when they're retired. Protected by
+ * ggggc_allocLock */
+static ggc_size_t allocatedWords;
+
+/* the free space in the pools, the largest free chunk, and the largest in
+ * each pool added up (in words), as of the last time they were all swept, and
+ * whether that's happened since the last collection. Only touched with the
+ * world stopped */
+static ggc_size_t freeWords, largestFree, contiguousWords;
+static int freeMeasured;
+
+/* measure the free space in the pools, once they've all been swept */
+static void measureFree()
+{
+    struct GGGGC_Pool *poolCur;
+
+    freeMeasured = TRUE;
+    freeWords = largestFree = contiguousWords = 0;
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next) {
+        freeWords += poolCur->freeBytes / sizeof(ggc_size_t);
+        contiguousWords += poolCur->largestFree / sizeof(ggc_size_t);
+        if (poolCur->largestFree / sizeof(ggc_size_t) > largestFree)
+            largestFree = poolCur->largestFree / sizeof(ggc_size_t);
+    }
+}
+
+#if defined(GGGGC_USE_MARK_BITMAP) && !defined(GGGGC_GENERATIONAL)
+/* marks from the last collection must be gone before we mark again, but the
+ * pools the allocator never reached needn't be swept for it: nothing in the
+ * bitmap sweep depends on dead objects, so their marks can simply be cleared.
+ * Their free lists are stale, but hold nothing live, so they count as swept.
+ * If the allocator did reach them all, the free space is known */
+static void clearUnsweptMarks()
+{
+    struct GGGGC_Pool *poolCur;
+    ggc_size_t firstWord, endWord;
+    int allSwept = TRUE;
+
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next) {
+        if (poolCur->swept) continue;
+        allSwept = FALSE;
+        firstWord = MARK_INDEX(poolCur->start) / GGGGC_BITS_PER_WORD;
+        endWord = (MARK_INDEX(poolCur->free - 1) + GGGGC_BITS_PER_WORD) / GGGGC_BITS_PER_WORD;
+        memset(poolCur->markBits + firstWord, 0, (endWord - firstWord) * sizeof(ggc_size_t));
+        poolCur->swept = 1;
+    }
+    if (allSwept) measureFree();
+}
+#endif
+
+/* add up what survived in the pools, before resizing forgets it */
+static ggc_size_t countSurvivors()
+{
+    struct GGGGC_Pool *poolCur;
+    ggc_size_t ret = 0;
+
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next)
+        ret += poolCur->survivors;
+    return ret;
+}
+
+/* fill in the rest of a collection's report, once the heap has been resized */
+static void finishReport(struct GGGGC_CollectionReport *report)
+{
+    struct GGGGC_Pool *poolCur;
+
+    report->pools = report->heapWords = 0;
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next) {
+        report->pools++;
+        report->heapWords += poolCur->end - poolCur->start;
+    }
+    report->allocated = allocatedWords;
+    allocatedWords = 0;
+    report->freeMeasured = freeMeasured;
+    report->freeWords = freeWords;
+    report->largestFree = largestFree;
+    report->contiguousWords = contiguousWords;
+    freeMeasured = FALSE;
+}
+
+/* give the insides of large free chunks back to the OS, keeping their headers */
+static void decommitFreeTree(struct GGGGC_FreeNode *node)
+{
+    struct GGGGC_Free *chunk;
+
+    if (!node) return;
+    decommitFreeTree(node->left);
+    decommitFreeTree(node->right);
+    for (chunk = &node->chunk; chunk; chunk = chunk->next)
+        ggggc_decommit((struct GGGGC_FreeNode *) chunk + 1, (ggc_size_t *) chunk + chunk->size);
+}
+
+/* once the heap is as small as it'll get, give what's free in the pools left
+ * back to the OS as well. They must all be swept to know what's free */
+static void trimPools()
+{
+    struct GGGGC_Pool *poolCur;
+
+    ggggc_sweep();
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next) {
+        decommitFreeTree(poolCur->freeTree);
+        ggggc_decommit(poolCur->free, poolCur->end);
+    }
+}
+
+/* large objects each have a pool of their own, outside of the pool list, and
+ * how much has been allocated in them since the last collection (in words).
+ * Both are protected by ggggc_allocLock */
+static struct GGGGC_Pool *largePools;
+static ggc_size_t largeAllocated;
+
+/* allocate a large object in a pool of its own, or return NULL if we can't */
+static ggc_size_t *allocLarge(struct GGGGC_Descriptor **descriptor, ggc_size_t size)
+{
+    struct GGGGC_Pool *pool;
+    ggc_size_t heapWords = 0;
+
+    /* large objects are only freed by collections, so collect once enough
+     * have been allocated to fill the rest of the heap */
+    ggc_mutex_lock_raw(&ggggc_allocLock);
+    for (pool = ggggc_rootPool; pool; pool = pool->next)
+        heapWords += pool->end - pool->start;
+    if (heapWords && largeAllocated + size > heapWords) {
+        ggc_mutex_unlock(&ggggc_allocLock);
+        GGC_PUSH_1(*descriptor);
+        ggggc_collect0(1);
+        GGC_POP();
+    } else {
+        ggc_mutex_unlock(&ggggc_allocLock);
+    }
+
+    if (!(pool = ggggc_newLargePool(size)))
+        return NULL;
+#ifdef GGGGC_GENERATIONAL
+    /* like any old object, it's found by its mark, and its initialization
+     * bypasses the write barrier */
+    pool->gen = 1;
+    MARK((struct GGGGC_Header *) pool->start);
+    pool->remember[GGGGC_CARD_OF(pool->start)] = 1;
+#endif
+
+    ggc_mutex_lock_raw(&ggggc_allocLock);
+    pool->next = largePools;
+    largePools = pool;
+    largeAllocated += size;
+    allocatedWords += size;
+    ggc_mutex_unlock(&ggggc_allocLock);
+    return pool->start;
+}
+
+/* free the large objects that weren't marked, with the world stopped.
+ * Returns the size of those left, in words */
+static ggc_size_t sweepLarge()
+{
+    struct GGGGC_Pool *pool, **link = &largePools;
+    struct GGGGC_Header *obj;
+    ggc_size_t survivors = 0;
+
+    while ((pool = *link)) {
+        obj = (struct GGGGC_Header *) pool->start;
+        if (IS_MARKED(obj)) {
+#ifndef GGGGC_GENERATIONAL
+            /* the mark is the start of the object for minor collections,
+             * but otherwise it has to go */
+            UNMARK(obj);
+#endif
+            pool->survivors = 0;
+            survivors += pool->end - pool->start;
+            link = &pool->next;
+        } else {
+            *link = pool->next;
+            ggggc_freeLargePool(pool);
+        }
+    }
+    largeAllocated = 0;
+    return survivors;
+}
+
+#ifdef GGGGC_GENERATIONAL
+/* the size of a nursery in words, and the largest object allocated in one.
+ * Anything larger is old from birth */
+#if GGGGC_NURSERY_SIZE < GGGGC_POOL_SIZE
+#define NURSERY_WORDS (((ggc_size_t) 1 << GGGGC_NURSERY_SIZE) / sizeof(ggc_size_t))
+#else
+#define NURSERY_WORDS GGGGC_WORDS_PER_POOL
+#endif
+#define NURSERY_MAX_OBJECT (NURSERY_WORDS / 4)
+
+/* this thread's nursery, a pool of its own. The TLAB is the rest of it */
+static ggc_thread_local struct GGGGC_Pool *nursery;
+
+/* every nursery, linked through next, and those of exited threads, waiting to
+ * be reused. Both are protected by ggggc_allocLock */
+static struct GGGGC_Pool *nurseries;
+static struct GGGGC_PoolList *spareNurseries;
+
+/* the TLAB is the nursery's bump region, so just catch the nursery up */
+static void retireTLABL()
+{
+    if (ggggc_tlabEnd)
+        nursery->free = ggggc_tlabFree;
+    ggggc_tlabFree = ggggc_tlabEnd = NULL;
+}
+
+void ggggc_retireTLAB()
+{
+    retireTLABL();
+}
+
+/* get a nursery for this thread. Must hold ggggc_allocLock */
+static struct GGGGC_Pool *newNursery()
+{
+    struct GGGGC_PoolList *spare;
+    struct GGGGC_Pool *ret;
+
+    /* an exited thread's nursery may still hold live objects, but those are
+     * promoted at the next minor collection like any others */
+    if ((spare = spareNurseries)) {
+        spareNurseries = spare->next;
+        ret = spare->pool;
+        free(spare);
+        return ret;
+    }
+
+    ret = ggggc_newPool(1);
+    if ((ggc_size_t) (ret->end - ret->start) > NURSERY_WORDS)
+        ret->end = ret->start + NURSERY_WORDS;
+    ret->next = nurseries;
+    nurseries = ret;
+    return ret;
+}
+
+void ggggc_retireNursery()
+{
+    struct GGGGC_PoolList *spare;
+
+    if (!nursery) return;
+    retireTLABL();
+
+    spare = (struct GGGGC_PoolList *) malloc(sizeof(struct GGGGC_PoolList));
+    if (spare == NULL) {
+        /* FIXME: handle somehow? */
+        perror("malloc");
+        abort();
+    }
+    ggc_mutex_lock_raw(&ggggc_allocLock);
+    spare->pool = nursery;
+    spare->next = spareNurseries;
+    spareNurseries = spare;
+    ggc_mutex_unlock(&ggggc_allocLock);
+    nursery = NULL;
+}
+
+/* allocate from this thread's nursery, emptying it with a minor collection if
+ * it's full. What the object doesn't use becomes this thread's new TLAB */
+static ggc_size_t *allocNursery(struct GGGGC_Descriptor **descriptor, ggc_size_t size)
+{
+    ggc_size_t *ret, *end;
+
+    retireTLABL();
+    if (!nursery) {
+        ggc_mutex_lock_raw(&ggggc_allocLock);
+        nursery = newNursery();
+        ggc_mutex_unlock(&ggggc_allocLock);
+    }
+
+    /* if somebody else collected instead, our nursery was emptied all the same */
+    while ((ggc_size_t) (nursery->end - nursery->free) < size) {
+        GGC_PUSH_1(*descriptor);
+        ggggc_collect0(0);
+        GGC_POP();
+    }
+
+    /* the nursery is handed out a TLAB at a time, so that each is still in
+     * cache from being zeroed when it's allocated in */
+    ret = nursery->free;
+    end = ret + ((size > GGGGC_TLAB_SIZE) ? size : GGGGC_TLAB_SIZE);
+    if (end > nursery->end) end = nursery->end;
+    memset(ret, 0, (end - ret) * sizeof(ggc_size_t));
+    ggggc_tlabFree = ret + size;
+    ggggc_tlabEnd = end;
+    return ret;
+}
+
+#else
+/* give the rest of a TLAB back to its pool. Must hold ggggc_allocLock */
+static void retireTLABL()
+{
+    if (ggggc_tlabFree < ggggc_tlabEnd) {
+        addFree(GGGGC_POOL_OF(ggggc_tlabFree), ggggc_tlabFree, ggggc_tlabEnd - ggggc_tlabFree);
+        allocatedWords -= ggggc_tlabEnd - ggggc_tlabFree;
+    }
+    ggggc_tlabFree = ggggc_tlabEnd = NULL;
+}
+
+void ggggc_retireTLAB()
+{
+    if (!ggggc_tlabEnd) return;
+    ggc_mutex_lock_raw(&ggggc_allocLock);
+    retireTLABL();
+    ggc_mutex_unlock(&ggggc_allocLock);
+}
+#endif
+
+#ifdef GGGGC_CONCURRENT_MARK
+/* have we used enough pools to start a concurrent mark? Must hold
+ * ggggc_allocLock */
+static int shouldStartMark()
+{
+    struct GGGGC_Pool *poolCur;
+    ggc_size_t poolCt = 0;
+
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next)
+        poolCt++;
+    return poolsUsed * 100 >= poolCt * GGGGC_CONCURRENT_START;
+}
+
+static void startConcurrentSweep();
+static void finishConcurrentSweep(int stop);
+static void startConcurrentMark();
+#endif
+
+/* allocate from the shared pools. Unless the object is large, a whole TLAB is
+ * taken, and what the object doesn't use becomes this thread's new TLAB. What's
+ * taken is returned zeroed */
+static ggc_size_t *allocShared(struct GGGGC_Descriptor **descriptor, ggc_size_t size)
+{
+    struct GGGGC_Pool *pool;
+    ggc_size_t *ret;
+    ggc_size_t want, got;
+    int expand = FALSE;
+#ifdef GGGGC_CONCURRENT_MARK
+    int remarkFailures = 0;
+#endif
+
+#ifdef GGGGC_GENERATIONAL
+    /* only large objects go straight into the shared pools */
+    if (size <= NURSERY_MAX_OBJECT)
+        return allocNursery(descriptor, size);
+    want = size;
+
+    ggc_mutex_lock_raw(&ggggc_allocLock);
+#else
+    /* a TLAB must have room for a free chunk after the object, or none at all */
+    if (size <= GGGGC_TLAB_SIZE / 2)
+        want = GGGGC_TLAB_SIZE;
+    else
+        want = size;
+
+    ggc_mutex_lock_raw(&ggggc_allocLock);
+    retireTLABL();
+#endif
+
+retry:
+#ifdef GGGGC_CONCURRENT_MARK
+    /* once the marker has swept what we hadn't, start it marking */
+    if (concSweeping && concSweepDone) {
+        finishConcurrentSweep(FALSE);
+        ggc_mutex_unlock(&ggggc_allocLock);
+        GGC_PUSH_1(*descriptor);
+        startConcurrentMark();
+        GGC_POP();
+        ggc_mutex_lock_raw(&ggggc_allocLock);
+    }
+
+    /* once the marker has run dry, finish its mark */
+    if (concActive && concDone) {
+        ggc_mutex_unlock(&ggggc_allocLock);
+        GGC_PUSH_1(*descriptor);
+        ggggc_collect0(0);
+        GGC_POP();
+        ggc_mutex_lock_raw(&ggggc_allocLock);
+    }
+#endif
+
+    if (ggggc_pool) {
+        pool = ggggc_pool;
+    } else {
+        ggggc_rootPool = ggggc_pool = pool = newOldPool();
+    }
+
+    /* the allocator sweeps pools as it reaches them */
+    if (!pool->swept)
+        ggggc_sweepPool(pool);
+
+    /* check the free lists of the pool in use first, then the unused space in the pool */
+    got = want;
+    if ((ret = (ggc_size_t *) allocFree(pool, size, &got))) {
+        /* found a free chunk */
+
+    } else if (pool->end - pool->free >= size) {
+        /* good, allocate here */
+        got = pool->end - pool->free;
+        if (got > want) got = want;
+        if (got == size + 1) got = size;
+        ret = pool->free;
+        pool->free += got;
+
+    } else if (pool->next) {
+        /* move to the next pool since the current pool don't have enough space to allocate the object*/
+        ggggc_pool = pool = pool->next;
+#ifdef GGGGC_CONCURRENT_MARK
+        /* start marking once enough of the heap is used, sweeping first */
+        poolsUsed++;
+        if (!concActive && !concSweeping && shouldStartMark())
+            startConcurrentSweep();
+#endif
+        goto retry;
+
+    } else {
+        /* a collection is needed since all the pools don't have enough space to allocate the object*/
+        /* if this is our second try, the collection must also grow the heap */
+#ifdef GGGGC_CONCURRENT_MARK
+        /* finishing a concurrent mark can't free what was allocated during
+         * it, so only a full collection failing is reason to expand. But a
+         * full heap starts marking again at once, so failing after two
+         * remarks is reason enough */
+        int remarked = concActive;
+#endif
+        if (expand) mustGrow = TRUE;
+        ggc_mutex_unlock(&ggggc_allocLock);
+        GGC_PUSH_1(*descriptor);
+        ggggc_collect0(1);
+        GGC_POP();
+        ggc_mutex_lock_raw(&ggggc_allocLock);
+#ifdef GGGGC_CONCURRENT_MARK
+        if (!remarked || ++remarkFailures > 1)
+#endif
+        expand = TRUE;
+        goto retry;
+    }
+
+    allocatedWords += got;
+
+#ifdef GGGGC_CONCURRENT_MARK
+    /* what's allocated during a concurrent mark survives it, so the heap
+     * policy mustn't release its pool */
+    if (ggggc_concurrentMarking)
+        __sync_fetch_and_add(&pool->survivors, got);
+#endif
+
+#ifdef GGGGC_GENERATIONAL
+    /* minor collections find old objects by their marks. Its initialization
+     * may bypass the write barrier, so its card is dirty from the start */
+    MARK((struct GGGGC_Header *) ret);
+    pool->remember[GGGGC_CARD_OF(ret)] = 1;
+    ggc_mutex_unlock(&ggggc_allocLock);
+    memset(ret, 0, got * sizeof(ggc_size_t));
+
+#else
+    ggc_mutex_unlock(&ggggc_allocLock);
+
+    /* the whole TLAB is zeroed at once, outside the lock, so that the mutator
+     * can allocate from it by just bumping a pointer */
+    memset(ret, 0, got * sizeof(ggc_size_t));
+    if (got > size) {
+        ggggc_tlabFree = ret + size;
+        ggggc_tlabEnd = ret + got;
+    }
+#endif
+    return ret;
+}
+
+void *ggggc_mallocRaw(struct GGGGC_Descriptor **descriptor, /* descriptor to protect, if applicable */
+                      ggc_size_t size /* size of object to allocate */
+) {
+    struct GGGGC_Header *ret;
+    ggc_size_t avail;
+
+    /* every object must be able to become a free chunk */
+    if (size == 1) {
+        size = 2;
+    }
+
+    GGGGC_SAMPLE_ALLOCATION(descriptor, size);
+
+    /* bump allocate from our TLAB if we can, never leaving it a single word,
+     * which couldn't be given back as a free chunk. Either way the object is
+     * already zeroed (necessary since this goes to the untrusted mutator) */
+    avail = ggggc_tlabEnd - ggggc_tlabFree;
+    if (size >= GGGGC_LARGE_OBJECT &&
+        (ret = (struct GGGGC_Header *) allocLarge(descriptor, size))) {
+        /* a fresh mapping */
+    } else if (avail == size || avail >= size + GGGGC_WORD_SIZEOF(struct GGGGC_Free)) {
+        ret = (struct GGGGC_Header *) ggggc_tlabFree;
+        ggggc_tlabFree += size;
+    } else {
+        ret = (struct GGGGC_Header *) allocShared(descriptor, size);
+    }
+
+#ifdef GGGGC_CONCURRENT_MARK
+    /* objects allocated during a concurrent mark live through it */
+    if (ggggc_concurrentMarking)
+        __sync_fetch_and_or(&MARK_WORD(ret), MARK_BIT(ret));
+#endif
+#ifdef GGGGC_DEBUG_MEMORY_CORRUPTION
+    /* set its canary */
+    ret->ggggc_memoryCorruptionCheck = GGGGC_MEMORY_CORRUPTION_VAL;
+#endif
+    return ret;
+}
+
+/* allocate an object */
+void *ggggc_malloc(struct GGGGC_Descriptor *descriptor)
+{
+    struct GGGGC_Header *ret = (struct GGGGC_Header *) ggggc_mallocRaw(&descriptor, descriptor->size);
+    ret->descriptor__ptr = descriptor;
+    return ret;
+}
+
+/* stop the world, with every thread's roots in the root lists. Our own root
+ * nodes are provided by the caller. Returns false if somebody else was already
+ * stopping the world, in which case we've yielded to them instead */
+static int stopWorld(struct GGGGC_PointerStackList *pointerStackNode,
+                     struct GGGGC_JITPointerStackList *jitPointerStackNode)
+{
+    /* first, make sure we stop the world */
+    while (ggc_mutex_trylock(&ggggc_worldBarrierLock) != 0) {
+        /* somebody else is collecting, so just let them */
+        if (ggggc_stopTheWorld) {
+            ggggc_yield();
+            return FALSE;
+        }
+    }
+
+    /* if nobody ever initialized the barrier, do so */
+    if (ggggc_threadCount == 0) {
+        ggggc_threadCount = 1;
+        ggc_barrier_init(&ggggc_worldBarrier, ggggc_threadCount);
+    }
+
+    /* our TLAB is about to be swept */
+    ggggc_retireTLAB();
+#ifdef GGGGC_CONCURRENT_MARK
+    ggggc_retireSATB();
+#endif
+
+    /* initialize our roots */
+    ggc_mutex_lock_raw(&ggggc_rootsLock);
+    pointerStackNode->pointerStack = ggggc_pointerStack;
+    pointerStackNode->next = ggggc_blockedThreadPointerStacks;
+    ggggc_rootPointerStackList = pointerStackNode;
+    jitPointerStackNode->cur = ggc_jitPointerStack;
+    jitPointerStackNode->top = ggc_jitPointerStackTop;
+    jitPointerStackNode->next = ggggc_blockedThreadJITPointerStacks;
+    ggggc_rootJITPointerStackList = jitPointerStackNode;
+    ggc_mutex_unlock(&ggggc_rootsLock);
+
+    /* stop the world */
+    ggggc_stopTheWorld = 1;
+    ggc_barrier_wait_raw(&ggggc_worldBarrier);
+    ggggc_stopTheWorld = 0;
+
+    /* wait for them to fill roots */
+    ggc_barrier_wait_raw(&ggggc_worldBarrier);
+
+    return TRUE;
+}
+
+/* free the other threads */
+static void startWorld()
+{
+    ggc_barrier_wait_raw(&ggggc_worldBarrier);
+    ggc_mutex_unlock(&ggggc_worldBarrierLock);
+}
+
+#ifdef GGGGC_CONCURRENT_MARK
+/* start the marker thread, the first time it's needed */
+static void startMarker()
+{
+    pthread_t th;
+
+    if (concStarted) return;
+    ggc_sem_init(&concStart, 0);
+    ggc_sem_init(&concFinished, 0);
+    if ((errno = pthread_create(&th, NULL, concMarkThread, NULL))) {
+        perror("pthread_create");
+        abort();
+    }
+    pthread_detach(th);
+    concStarted = TRUE;
+}
+
+/* have the marker sweep the pools we haven't reached, before it marks. Must
+ * hold ggggc_allocLock */
+static void startConcurrentSweep()
+{
+    startMarker();
+    concSweeping = TRUE;
+    concSweepDone = concStop = FALSE;
+    ggc_sem_post(&concStart);
+}
+
+/* wait for the marker to finish sweeping, or to stop early if asked */
+static void finishConcurrentSweep(int stop)
+{
+    if (stop) concStop = TRUE;
+    ggc_sem_wait_raw(&concFinished);
+    concSweeping = FALSE;
+}
+
+/* start a concurrent mark, in a short pause. The marker has already swept, so
+ * there are rarely any marks left to clear */
+static void startConcurrentMark()
+{
+    struct GGGGC_PointerStackList pointerStackNode;
+    struct GGGGC_JITPointerStackList jitPointerStackNode;
+
+    if (!stopWorld(&pointerStackNode, &jitPointerStackNode)) return;
+
+    /* somebody may have beaten us to it */
+    if (!concActive) {
+        ggggc_initialMarkStart();
+        clearUnsweptMarks();
+
+        if (!markWorkerCount) initMarkWorkers();
+        startMarker();
+
+        /* the mutator will race us for mark bits */
+        markParallel = TRUE;
+        markIdle = 0;
+        shadeRoots(&markWorkers[0]);
+
+        concStop = concDone = FALSE;
+        concActive = TRUE;
+        ggggc_concurrentMarking = 1;
+        ggc_sem_post(&concStart);
+        ggggc_initialMarkEnd();
+    }
+
+    startWorld();
+}
+#endif
+
+#ifdef GGGGC_GENERATIONAL
+/* where the nursery's survivors are promoted to, whether they overflowed the
+ * old generation, so that it must be collected too, and how much was promoted
+ * (in words) */
+static struct GGGGC_Pool *promotePool;
+static int promoteOverflow;
+static ggc_size_t promoted;
+
+/* allocate old space for a survivor, growing the old generation if need be */
+static struct GGGGC_Header *promoteAlloc(ggc_size_t size)
+{
+    struct GGGGC_Pool *pool;
+    struct GGGGC_Header *ret;
+    ggc_size_t got;
+
+    if (!promotePool) {
+        if (!ggggc_rootPool)
+            ggggc_rootPool = ggggc_pool = newOldPool();
+        promotePool = ggggc_rootPool;
+    }
+
+    while (1) {
+        pool = promotePool;
+        got = size;
+        if ((ret = (struct GGGGC_Header *) allocFree(pool, size, &got)))
+            break;
+        if (pool->end - pool->free >= size) {
+            ret = (struct GGGGC_Header *) pool->free;
+            pool->free += size;
+            break;
+        }
+        if (!pool->next) {
+            pool->next = newOldPool();
+            promoteOverflow = TRUE;
+        }
+        promotePool = pool->next;
+    }
+
+    MARK(ret);
+    promoted += size;
+    return ret;
+}
+
+/* copy an object out of the nursery, leaving a forwarding pointer in its
+ * descriptor slot. The original is otherwise untouched until the nursery is
+ * emptied, so its descriptor can still be read even if it's been promoted */
+static struct GGGGC_Header *promote(struct MarkWorker *w, struct GGGGC_Header *obj)
+{
+    struct GGGGC_Descriptor *descriptor = obj->descriptor__ptr;
+    struct GGGGC_Header *ret;
+    ggc_size_t size = descriptor->size;
+
+    if (size == 1) size = 2;
+    ret = promoteAlloc(size);
+    memcpy(ret, obj, size * sizeof(ggc_size_t));
+    obj->descriptor__ptr = (struct GGGGC_Descriptor *) ((ggc_size_t) ret | 1);
+
+    ADD_OBJECT_POINTERS(w, ret, descriptor);
+    return ret;
+}
+
+/* point a slot at the promoted copy of whatever it refers to in the nursery */
+static void promoteSlot(struct MarkWorker *w, void **slot)
+{
+    struct GGGGC_Header *obj = (struct GGGGC_Header *) *slot;
+    ggc_size_t forward;
+
+    if (!obj || IS_TAGGED(obj) || GGGGC_POOL_OF(obj)->gen) return;
+    forward = (ggc_size_t) obj->descriptor__ptr;
+    if (forward & 1)
+        *slot = (void *) (forward & ~(ggc_size_t) 1);
+    else
+        *slot = promote(w, obj);
+}
+
+/* add the pointers of every old object starting in a dirty card */
+static void scanCard(struct MarkWorker *w, struct GGGGC_Pool *pool, ggc_size_t card)
+{
+    struct GGGGC_Descriptor *descriptor;
+    struct GGGGC_Header *obj;
+    ggc_size_t i, end, bits;
+
+    i = card * (GGGGC_CARD_BYTES / sizeof(ggc_size_t));
+    end = i + GGGGC_CARD_BYTES / sizeof(ggc_size_t);
+    while (i < end) {
+        bits = pool->markBits[i / GGGGC_BITS_PER_WORD] >> (i % GGGGC_BITS_PER_WORD);
+        if (!bits) {
+            i = (i / GGGGC_BITS_PER_WORD + 1) * GGGGC_BITS_PER_WORD;
+            continue;
+        }
+        i += GGGGC_CTZ(bits);
+        if (i >= end) break;
+
+        obj = (struct GGGGC_Header *) ((ggc_size_t *) pool + i);
+        descriptor = obj->descriptor__ptr;
+        ADD_OBJECT_POINTERS(w, obj, descriptor);
+        i++;
+    }
+}
+
+/* empty every nursery into the old generation, with the world stopped.
+ * Returns true if the old generation overflowed */
+static int minorCollect()
+{
+    struct GGGGC_PointerStackList *pslCur;
+    struct GGGGC_JITPointerStackList *jpslCur;
+    struct GGGGC_PointerStack *psCur;
+    struct GGGGC_Pool *poolCur;
+    struct MarkWorker *w;
+    struct ToSearch *chunk;
+    void **jpsCur;
+    ggc_size_t i;
+    int overflow;
+
+    if (!markWorkerCount) initMarkWorkers();
+    w = &markWorkers[0];
+
+    /* promote what the roots refer to */
+    for (pslCur = ggggc_rootPointerStackList; pslCur; pslCur = pslCur->next) {
+        for (psCur = pslCur->pointerStack; psCur; psCur = psCur->next) {
+            for (i = 0; i < psCur->size; i++)
+                promoteSlot(w, (void **) psCur->pointers[i]);
+        }
+    }
+    for (jpslCur = ggggc_rootJITPointerStackList; jpslCur; jpslCur = jpslCur->next) {
+        for (jpsCur = jpslCur->cur; jpsCur < jpslCur->top; jpsCur++)
+            promoteSlot(w, jpsCur);
+    }
+
+    /* and what old objects written to since the last collection refer to */
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next) {
+        for (i = 0; i < GGGGC_CARDS_PER_POOL; i++) {
+            if (poolCur->remember[i]) {
+                poolCur->remember[i] = 0;
+                scanCard(w, poolCur, i);
+            }
+        }
+    }
+
+    /* the barrier marks a large object's card by its start, the only one */
+    for (poolCur = largePools; poolCur; poolCur = poolCur->next) {
+        i = GGGGC_CARD_OF(poolCur->start);
+        if (poolCur->remember[i]) {
+            poolCur->remember[i] = 0;
+            ADD_OBJECT_POINTERS(w, (struct GGGGC_Header *) poolCur->start,
+                ((struct GGGGC_Header *) poolCur->start)->descriptor__ptr);
+        }
+    }
+
+    /* then everything the promoted objects refer to */
+    ggggc_collectionPhase(GGGGC_PHASE_COPY);
+    while (1) {
+        if (!w->toSearch->used) {
+            if (!(chunk = popChunk(w))) break;
+            takeChunk(w, chunk);
+        }
+        promoteSlot(w, (void **) w->toSearch->buf[--w->toSearch->used]);
+    }
+
+    for (poolCur = nurseries; poolCur; poolCur = poolCur->next) {
+        allocatedWords += poolCur->free - poolCur->start;
+        poolCur->free = poolCur->start;
+    }
+
+    overflow = promoteOverflow;
+    promoteOverflow = FALSE;
+    return overflow;
+}
+
+/* collect the old generation, just after a minor collection has emptied the
+ * nurseries into it */
+static void majorCollect(struct GGGGC_CollectionReport *report)
+{
+    struct GGGGC_Pool *poolCur;
+
+    /* until now, the marks were only the starts of objects */
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next)
+        memset(poolCur->markBits, 0, sizeof(poolCur->markBits));
+    for (poolCur = largePools; poolCur; poolCur = poolCur->next)
+        UNMARK((struct GGGGC_Header *) poolCur->start);
+    ggggc_markPhase();
+    ggggc_collectionPhase(GGGGC_PHASE_SWEEP);
+    report->full = TRUE;
+    report->survivors = sweepLarge();
+
+    /* the new marks are the starts of the objects left, and must be in place
+     * before the next minor collection, so sweep it all now */
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next)
+        poolCur->swept = 0;
+    ggggc_sweep();
+    measureFree();
+    report->survivors += countSurvivors();
+
+    ggggc_collectionPhase(GGGGC_PHASE_RESIZE);
+    ggggc_resizePoolList(ggggc_rootPool, newOldPool, mustGrow, trimHeap);
+    if (trimHeap) trimPools();
+    mustGrow = trimHeap = FALSE;
+    ggggc_pool = promotePool = ggggc_rootPool;
+}
+#endif
+
+void ggggc_collect0(unsigned char gen)
+{
+    struct GGGGC_Pool *poolCur;
+    struct GGGGC_PointerStackList pointerStackNode;
+    struct GGGGC_JITPointerStackList jitPointerStackNode;
+    struct GGGGC_CollectionReport report;
+
+    if (!stopWorld(&pointerStackNode, &jitPointerStackNode)) return;
+    ggggc_collectionStart();
+    report.remark = FALSE;
+
+#ifdef GGGGC_GENERATIONAL
+    /* the old generation is only collected when asked, or when it's full */
+    promoted = 0;
+    if (minorCollect() || gen) {
+        majorCollect(&report);
+    } else {
+        report.full = FALSE;
+        report.survivors = promoted;
+    }
+
+#else
+#ifdef GGGGC_CONCURRENT_MARK
+    if (concActive) {
+        /* most of the marking is already done */
+        remark();
+        report.remark = TRUE;
+    } else
+#endif
+    {
+#ifdef GGGGC_CONCURRENT_MARK
+        /* a sweep before marking is cut short, as the marks are cleared */
+        if (concSweeping)
+            finishConcurrentSweep(TRUE);
+#endif
+#ifdef GGGGC_USE_MARK_BITMAP
+        ggggc_collectionPhase(GGGGC_PHASE_SWEEP);
+        clearUnsweptMarks();
+#endif
+        ggggc_markPhase();
+    }
+    ggggc_collectionPhase(GGGGC_PHASE_SWEEP);
+    report.full = TRUE;
+    report.survivors = sweepLarge() + countSurvivors();
+
+#ifdef GGGGC_USE_MARK_BITMAP
+    /* leave the sweeping to the allocator */
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next)
+        poolCur->swept = 0;
+
+#else
+    /* marks in headers are visible to the mutator through descriptor__ptr
+     * (e.g. GGC_RUP), so they can't outlive the collection. Sweep it all now */
+    for (poolCur = ggggc_rootPool; poolCur; poolCur = poolCur->next) {
+        poolCur->swept = 0;
+        unsweptPools++;
+    }
+    ggggc_sweep();
+    measureFree();
+
+#endif
+
+    /* size the heap for what survived, then start allocating over from the
+     * first pool */
+    ggggc_collectionPhase(GGGGC_PHASE_RESIZE);
+    ggggc_resizePoolList(ggggc_rootPool, newOldPool, mustGrow, trimHeap);
+    if (trimHeap) trimPools();
+    mustGrow = trimHeap = FALSE;
+    ggggc_pool = ggggc_rootPool;
+#ifdef GGGGC_CONCURRENT_MARK
+    poolsUsed = 0;
+#endif
+#endif
+
+    finishReport(&report);
+    ggggc_collectionEnd(&report);
+    startWorld();
+}
+
+void ggggc_trim()
+{
+    ggc_mutex_lock_raw(&ggggc_allocLock);
+    trimHeap = TRUE;
+    ggc_mutex_unlock(&ggggc_allocLock);
+    ggggc_collect0(1);
+}
+
+/* explicitly yield to the collector */
+int ggggc_yield()
+{
+    struct GGGGC_PointerStackList pointerStackNode;
+    struct GGGGC_JITPointerStackList jitPointerStackNode;
+
+    if (ggggc_stopTheWorld) {
+        /* our TLAB is about to be swept */
+        ggggc_retireTLAB();
+#ifdef GGGGC_CONCURRENT_MARK
+        ggggc_retireSATB();
+#endif
+
+        /* wait for the barrier once to stop the world */
+        ggc_barrier_wait_raw(&ggggc_worldBarrier);
+
+        /* feed it my roots */
+        ggc_mutex_lock_raw(&ggggc_rootsLock);
+        pointerStackNode.pointerStack = ggggc_pointerStack;
+        pointerStackNode.next = ggggc_rootPointerStackList;
+        ggggc_rootPointerStackList = &pointerStackNode;
+        jitPointerStackNode.cur = ggc_jitPointerStack;
+        jitPointerStackNode.top = ggc_jitPointerStackTop;
+        jitPointerStackNode.next = ggggc_rootJITPointerStackList;
+        ggggc_rootJITPointerStackList = &jitPointerStackNode;
+        ggc_mutex_unlock(&ggggc_rootsLock);
+
+        /* wait for the barrier once to allow collection */
+        ggc_barrier_wait_raw(&ggggc_worldBarrier);
+
+        /* wait for the barrier to know when collection is done */
+        ggc_barrier_wait_raw(&ggggc_worldBarrier);
+    }
+
+    return 0;
+}
+
+#ifdef __cplusplus
+}
 #endif
\ No newline at end of file
@@ -49,6 +49,33 @@
 
 #endif
 
+#ifdef GGGGC_CONCURRENT_MARK
+/* is concurrent marking running, and so the SATB barrier active? */
+extern volatile ggc_size_t ggggc_concurrentMarking;
+
+/* this thread's SATB buffer of overwritten pointers, and the current position
+ * and end within it */
+extern ggc_thread_local void *ggggc_satbBuffer;
+extern ggc_thread_local void **ggggc_satbCur, **ggggc_satbEnd;
+
+/* hand this thread's SATB buffer to the collector and start a new one */
+void ggggc_satbFlush(void);
+
+/* while marking, log the pointer about to be overwritten, so that everything
+ * reachable when marking started is marked */
+#define GGGGC_SATB(object, member) do { \
+    if (ggggc_concurrentMarking) { \
+        void *ggggc_old = (void *) (object)->member; \
+        if (ggggc_old && !((ggc_size_t) ggggc_old & (sizeof(ggc_size_t)-1))) { \
+            if (ggggc_satbCur == ggggc_satbEnd) ggggc_satbFlush(); \
+            *ggggc_satbCur++ = ggggc_old; \
+        } \
+    } \
+} while(0)
+#else
+#define GGGGC_SATB(object, member)
+#endif
+
 /* write barriers */
 #if GGGGC_GENERATIONS > 1
 #define GGGGC_WP(object, member, value) do { \
@@ -60,12 +87,14 @@
         /* a high-gen object, let's remember it */ \
         ggggc_pool->remember[GGGGC_CARD_OF(ggggc_o)] = 1; \
     } \
+    GGGGC_SATB(object, member); \
     (object)->member = (value); \
 } while(0)
 #else
 #define GGGGC_WP(object, member, value) do { \
     GGGGC_ASSERT_ID(object); \
     GGGGC_ASSERT_ID(value); \
+    GGGGC_SATB(object, member); \
     (object)->member = (value); \
 } while(0)
 #endif
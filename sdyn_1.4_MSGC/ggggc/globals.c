@@ -3,6 +3,7 @@
 /* publics */
 ggc_thread_local struct GGGGC_PointerStack *ggggc_pointerStack, *ggggc_pointerStackGlobals;
 ggc_thread_local void **ggc_jitPointerStack, **ggc_jitPointerStackTop;
+ggc_thread_local struct GGGGC_AllocContext *ggggc_allocContext;
 
 /* internals */
 volatile int ggggc_stopTheWorld;
@@ -16,9 +17,19 @@ struct GGGGC_JITPointerStackList *ggggc_rootJITPointerStackList;
 struct GGGGC_PoolList *ggggc_blockedThreadPool0s;
 struct GGGGC_PointerStackList *ggggc_blockedThreadPointerStacks;
 struct GGGGC_JITPointerStackList *ggggc_blockedThreadJITPointerStacks;
-ggc_thread_local struct GGGGC_Pool *ggggc_rootPool;
-ggc_thread_local struct GGGGC_Pool *ggggc_pool;
+struct GGGGC_Pool *ggggc_rootPool;
+struct GGGGC_Pool *ggggc_pool;
+ggc_mutex_t ggggc_allocLock = GGC_MUTEX_INITIALIZER;
+ggc_thread_local ggc_size_t *ggggc_tlabFree, *ggggc_tlabEnd;
+ggc_thread_local ggc_size_t ggggc_sampleLeft;
+#ifdef GGGGC_CONCURRENT_MARK
+volatile ggc_size_t ggggc_concurrentMarking;
+ggc_thread_local void *ggggc_satbBuffer;
+ggc_thread_local void **ggggc_satbCur, **ggggc_satbEnd;
+#endif
 struct GGGGC_Pool *ggggc_gens[GGGGC_GENERATIONS];
 struct GGGGC_Pool *ggggc_pools[GGGGC_GENERATIONS];
-struct GGGGC_Descriptor *ggggc_descriptorDescriptors[GGGGC_WORDS_PER_POOL/GGGGC_BITS_PER_WORD+sizeof(struct GGGGC_Descriptor)];
+struct GGGGC_Descriptor *ggggc_descriptorDescriptors[GGGGC_DESCRIPTOR_DESCRIPTORS];
 ggc_mutex_t ggggc_descriptorDescriptorsLock;
+struct GGGGC_Descriptor *ggggc_arrayDescriptors[2][GGGGC_ARRAY_DESCRIPTOR_CACHE];
+ggc_mutex_t ggggc_arrayDescriptorsLock = GGC_MUTEX_INITIALIZER;
@@ -0,0 +1,311 @@
+/*
+ * Allocation-site sampling profiler
+ *
+ * Copyright (c) 2014, 2015 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* for standards info */
+#if defined(unix) || defined(__unix) || defined(__unix__) || \
+    (defined(__APPLE__) && defined(__MACH__))
+#include <unistd.h>
+#endif
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GLIBC__) || (defined(__APPLE__) && defined(__MACH__))
+#define GGGGC_PROFILE_BACKTRACE 1
+#include <execinfo.h>
+#endif
+
+#include "ggggc/gc.h"
+#include "ggggc-internals.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* how many C frames and embedder contexts a sample keeps */
+#ifndef GGGGC_PROFILE_FRAMES
+#define GGGGC_PROFILE_FRAMES 24
+#endif
+#ifndef GGGGC_PROFILE_CONTEXTS
+#define GGGGC_PROFILE_CONTEXTS 16
+#endif
+
+/* while sampling is off, how many words a thread allocates between checks of
+ * whether it's been turned on */
+#ifndef GGGGC_PROFILE_RECHECK
+#define GGGGC_PROFILE_RECHECK ((ggc_size_t) 1 << 20)
+#endif
+
+/* where samples are aggregated: one entry per distinct site */
+struct SampleSite {
+    /* the key, compared whole, so it must be zeroed before filling. What's
+     * allocated is told apart by its size and layout (from its descriptor's
+     * pointerArray and first word of pointers) rather than by its descriptor,
+     * which a copying collector moves */
+    ggc_size_t size, pointerArray, pointers;
+    int frameCt, contextCt;
+    void *frames[GGGGC_PROFILE_FRAMES]; /* innermost first */
+    const char *contexts[GGGGC_PROFILE_CONTEXTS]; /* innermost first */
+    size_t contextLens[GGGGC_PROFILE_CONTEXTS];
+
+    /* and what's been sampled there */
+    ggc_size_t samples, bytes;
+};
+
+/* the sites, in an open-addressed hash table, protected by profileLock */
+static ggc_mutex_t profileLock = GGC_MUTEX_INITIALIZER;
+static struct SampleSite **sites;
+static ggc_size_t siteCt, siteCap;
+
+/* the sampling interval in words (0 if off), whether the environment has
+ * been read, and the file the profile is dumped to */
+static ggc_size_t interval;
+static int configured;
+static const char *profileFile;
+
+/* set by SIGUSR2 to dump the profile at the next sample */
+static volatile sig_atomic_t dumpRequested;
+
+static ggc_size_t hashSite(struct SampleSite *site)
+{
+    unsigned char *key = (unsigned char *) site;
+    ggc_size_t i, h = 5381;
+    for (i = 0; i < offsetof(struct SampleSite, samples); i++)
+        h = h * 33 + key[i];
+    return h;
+}
+
+/* find or add a site, with profileLock held */
+static struct SampleSite *findSite(struct SampleSite *key)
+{
+    struct SampleSite **oldSites, *site;
+    ggc_size_t oldCap, i, h;
+
+    /* keep the table at most half full */
+    if ((siteCt + 1) * 2 > siteCap) {
+        oldSites = sites;
+        oldCap = siteCap;
+        siteCap = siteCap ? siteCap * 2 : 256;
+        sites = (struct SampleSite **) calloc(siteCap, sizeof(struct SampleSite *));
+        if (!sites) {
+            perror("calloc");
+            abort();
+        }
+        for (i = 0; i < oldCap; i++) {
+            if (!(site = oldSites[i])) continue;
+            for (h = hashSite(site) % siteCap; sites[h]; h = (h + 1) % siteCap);
+            sites[h] = site;
+        }
+        free(oldSites);
+    }
+
+    for (h = hashSite(key) % siteCap; (site = sites[h]); h = (h + 1) % siteCap) {
+        if (!memcmp(site, key, offsetof(struct SampleSite, samples)))
+            return site;
+    }
+
+    site = (struct SampleSite *) malloc(sizeof(struct SampleSite));
+    if (!site) {
+        perror("malloc");
+        abort();
+    }
+    memcpy(site, key, sizeof(struct SampleSite));
+    sites[h] = site;
+    siteCt++;
+    return site;
+}
+
+static void requestDump(int sig)
+{
+    dumpRequested = 1;
+}
+
+static void dumpAtExit()
+{
+    ggggc_dumpAllocationProfile(NULL);
+}
+
+/* the words until the next sample. Jittered, so that periodic allocation
+ * patterns don't alias with it, by a generator of our own so as not to disturb
+ * the program's rand() */
+static ggc_thread_local unsigned long jitter;
+static ggc_size_t nextSample()
+{
+    if (!interval) return GGGGC_PROFILE_RECHECK;
+    if (!jitter) jitter = (unsigned long) (size_t) &jitter | 1;
+    jitter ^= jitter << 13;
+    jitter ^= jitter >> 7;
+    jitter ^= jitter << 17;
+    return interval / 2 + jitter % (interval + 1);
+}
+
+/* once sampling is on, dump the profile at exit and on SIGUSR2. With
+ * profileLock held */
+static void hookDump()
+{
+    static int hooked;
+    if (hooked) return;
+    atexit(dumpAtExit);
+#ifdef SIGUSR2
+    signal(SIGUSR2, requestDump);
+#endif
+    hooked = 1;
+}
+
+/* read the configuration from the environment */
+static void configure()
+{
+    const char *val;
+
+    ggc_mutex_lock_raw(&profileLock);
+    if (!configured) {
+        if ((val = getenv("GGGGC_ALLOC_SAMPLE")) && *val)
+            interval = strtoul(val, NULL, 10) / sizeof(ggc_size_t);
+        profileFile = getenv("GGGGC_ALLOC_PROFILE");
+        if (!profileFile || !*profileFile)
+            profileFile = "ggggc-alloc.folded";
+        if (interval) hookDump();
+        configured = 1;
+    }
+    ggc_mutex_unlock(&profileLock);
+}
+
+void ggggc_setAllocationSampling(ggc_size_t bytes)
+{
+    configure();
+    ggc_mutex_lock_raw(&profileLock);
+    interval = bytes / sizeof(ggc_size_t);
+    if (interval) hookDump();
+    ggc_mutex_unlock(&profileLock);
+
+    /* other threads catch up at their next countdown */
+    ggggc_sampleLeft = nextSample();
+}
+
+void ggggc_sampleAllocation(struct GGGGC_Descriptor *descriptor, ggc_size_t size)
+{
+    struct SampleSite key, *site;
+    struct GGGGC_AllocContext *context;
+    int i;
+
+    if (!configured) configure();
+    ggggc_sampleLeft = nextSample();
+    if (!interval) return;
+
+    memset(&key, 0, sizeof(key));
+    key.size = size;
+    if (descriptor) {
+        key.pointerArray = descriptor->pointerArray;
+        key.pointers = descriptor->pointers[0];
+    }
+#ifdef GGGGC_PROFILE_BACKTRACE
+    key.frameCt = backtrace(key.frames, GGGGC_PROFILE_FRAMES);
+#endif
+    for (context = ggggc_allocContext, i = 0;
+         context && i < GGGGC_PROFILE_CONTEXTS;
+         context = context->caller, i++) {
+        key.contexts[i] = context->name;
+        key.contextLens[i] = context->nameLen;
+    }
+    key.contextCt = i;
+
+    ggc_mutex_lock_raw(&profileLock);
+    site = findSite(&key);
+    site->samples++;
+    /* each sample stands for the interval it ended, or itself if larger */
+    site->bytes += ((size > interval) ? size : interval) * sizeof(ggc_size_t);
+    ggc_mutex_unlock(&profileLock);
+
+    if (dumpRequested) {
+        dumpRequested = 0;
+        ggggc_dumpAllocationProfile(NULL);
+    }
+}
+
+/* write a C frame's name, as backtrace_symbols gave it */
+static void writeFrame(FILE *f, const char *sym)
+{
+    const char *start, *end;
+
+    /* glibc gives "file(name+offset) [address]", and we want just the name */
+    if ((start = strchr(sym, '(')) && (end = strpbrk(start, "+)")) && end > start + 1) {
+        fprintf(f, "%.*s", (int) (end - start - 1), start + 1);
+        return;
+    }
+    for (; *sym && *sym != ' '; sym++)
+        fputc((*sym == ';') ? ':' : *sym, f);
+}
+
+int ggggc_dumpAllocationProfile(const char *filename)
+{
+    struct SampleSite *site;
+    char **syms;
+    FILE *f;
+    ggc_size_t i;
+    int j, first;
+
+    if (!filename) filename = profileFile;
+    if (!filename) return -1;
+    if (!(f = fopen(filename, "w"))) {
+        perror(filename);
+        return -1;
+    }
+
+    ggc_mutex_lock_raw(&profileLock);
+    for (i = 0; i < siteCap; i++) {
+        if (!(site = sites[i])) continue;
+
+        /* outermost first: the embedder's contexts, then the C stack, less
+         * the allocator itself */
+        first = 1;
+        for (j = site->contextCt - 1; j >= 0; j--) {
+            fprintf(f, "%s%.*s", first ? "" : ";",
+                (int) site->contextLens[j], site->contexts[j]);
+            first = 0;
+        }
+#ifdef GGGGC_PROFILE_BACKTRACE
+        if ((syms = backtrace_symbols(site->frames, site->frameCt))) {
+            for (j = site->frameCt - 1; j >= 1; j--) {
+                if (strstr(syms[j], "(ggggc_malloc")) break;
+                if (!first) fputc(';', f);
+                writeFrame(f, syms[j]);
+                first = 0;
+            }
+            free(syms);
+        }
+#endif
+        if (site->pointerArray)
+            fprintf(f, "%s[%lu words, pointer array] %lu\n", first ? "" : ";",
+                (unsigned long) site->size, (unsigned long) site->bytes);
+        else
+            fprintf(f, "%s[%lu words, pointers %#lx] %lu\n", first ? "" : ";",
+                (unsigned long) site->size, (unsigned long) site->pointers,
+                (unsigned long) site->bytes);
+    }
+    ggc_mutex_unlock(&profileLock);
+
+    fclose(f);
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,87 @@
+/*
+ * Allocation rate microbenchmark: keeps a window of small objects alive and
+ * replaces them at random, so the heap is always fragmented into small holes.
+ * Prints objects allocated per second.
+ *
+ * Usage: allocrate [live objects] [allocations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#include "ggggc/gc.h"
+
+/* 2-, 3-, 4- and 6-word objects, like numbers, strings and map entries */
+GGC_TYPE(Small2)
+    GGC_MPTR(Small2, next);
+GGC_END_TYPE(Small2,
+    GGC_PTR(Small2, next)
+    )
+
+GGC_TYPE(Small3)
+    GGC_MPTR(Small3, next);
+    GGC_MDATA(long, a);
+GGC_END_TYPE(Small3,
+    GGC_PTR(Small3, next)
+    )
+
+GGC_TYPE(Small4)
+    GGC_MPTR(Small4, next);
+    GGC_MDATA(long, a);
+    GGC_MDATA(long, b);
+GGC_END_TYPE(Small4,
+    GGC_PTR(Small4, next)
+    )
+
+GGC_TYPE(Small6)
+    GGC_MPTR(Small6, next);
+    GGC_MDATA(long, a);
+    GGC_MDATA(long, b);
+    GGC_MDATA(long, c);
+    GGC_MDATA(long, d);
+GGC_END_TYPE(Small6,
+    GGC_PTR(Small6, next)
+    )
+
+/* Get the current time in milliseconds */
+static double currentTime(void)
+{
+    struct timeval t;
+    gettimeofday(&t, NULL);
+    return t.tv_sec * 1000.0 + t.tv_usec / 1000.0;
+}
+
+int main(int argc, char **argv)
+{
+    long live = 100000, allocations = 20000000, i;
+    unsigned long rng = 42;
+    double start, end;
+    GGC_voidpArray window = NULL;
+    void *obj = NULL;
+
+    GGC_PUSH_2(window, obj);
+
+    if (argc > 1) live = atol(argv[1]);
+    if (argc > 2) allocations = atol(argv[2]);
+
+    window = GGC_NEW_PA(GGC_voidp, live);
+
+    start = currentTime();
+    for (i = 0; i < allocations; i++) {
+        rng = rng * 6364136223846793005UL + 1442695040888963407UL;
+        switch ((rng >> 33) & 3) {
+            case 0: obj = GGC_NEW(Small2); break;
+            case 1: obj = GGC_NEW(Small3); break;
+            case 2: obj = GGC_NEW(Small4); break;
+            default: obj = GGC_NEW(Small6); break;
+        }
+        GGC_WAP(window, (rng >> 40) % live, obj);
+    }
+    end = currentTime();
+
+    printf("%ld allocations (%ld live) in %.0f ms: %.0f allocations/s\n",
+        allocations, live, end - start, allocations / ((end - start) / 1000.0));
+
+    return 0;
+}
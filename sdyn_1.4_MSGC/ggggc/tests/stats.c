@@ -0,0 +1,83 @@
+/*
+ * Statistics, trimming and allocation sampling test: builds up a large live
+ * list, checks that the statistics saw the collections and allocation it
+ * took (allocation is counted as of each collection), drops the list and
+ * trims the heap, checking that it shrank, then checks that the sampled
+ * allocation profile was written.
+ *
+ * Usage: stats [list length] [profile file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "ggggc/gc.h"
+
+GGC_TYPE(Node)
+    GGC_MPTR(Node, next);
+    GGC_MDATA(long, a);
+    GGC_MDATA(long, b);
+GGC_END_TYPE(Node,
+    GGC_PTR(Node, next)
+    )
+
+static int failures;
+
+static void check(int ok, const char *what)
+{
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long length = 1000000, i;
+    const char *profile = "stats.folded";
+    struct GGGGC_Stats before, grown, trimmed;
+    struct stat sbuf;
+    Node list = NULL, node = NULL;
+
+    GGC_PUSH_2(list, node);
+
+    if (argc > 1) length = atol(argv[1]);
+    if (argc > 2) profile = argv[2];
+
+    ggggc_setAllocationSampling(4096);
+    ggggc_getStats(&before);
+
+    /* enough live data that the heap has to collect and grow */
+    for (i = 0; i < length; i++) {
+        node = GGC_NEW(Node);
+        GGC_WD(node, a, i);
+        GGC_WP(node, next, list);
+        list = node;
+    }
+    ggggc_getStats(&grown);
+    check(grown.collections > before.collections, "no collections counted");
+    check(grown.bytesAllocated > before.bytesAllocated, "no allocation counted");
+
+    /* with it gone, trimming should give most of the heap back */
+    list = node = NULL;
+    ggggc_trim();
+    ggggc_getStats(&trimmed);
+    check(trimmed.collections > grown.collections, "trim didn't collect");
+    check(trimmed.bytesAllocated >= before.bytesAllocated + length * sizeof(struct Node__ggggc_struct),
+        "allocation undercounted");
+    check(trimmed.heapBytes < grown.heapBytes, "trim didn't shrink the heap");
+
+    /* and the sampler saw it all happen */
+    remove(profile);
+    check(ggggc_dumpAllocationProfile(profile) == 0, "profile not dumped");
+    check(stat(profile, &sbuf) == 0 && sbuf.st_size > 0, "profile empty");
+    remove(profile);
+
+    printf("%lu collections, %lu bytes allocated, heap %lu -> %lu bytes: %s\n",
+        (unsigned long) trimmed.collections, (unsigned long) trimmed.bytesAllocated,
+        (unsigned long) grown.heapBytes, (unsigned long) trimmed.heapBytes,
+        failures ? "FAIL" : "ok");
+
+    return failures ? 1 : 0;
+}
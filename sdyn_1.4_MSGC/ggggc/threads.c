@@ -45,6 +45,15 @@ static void *ggggcThreadWrapper(void *arg)
 
     GGC_RD(ti, func)(GGC_RP(ti, arg));
 
+    /* give back what's left of our TLAB while we can still be collected */
+    ggggc_retireTLAB();
+#ifdef GGGGC_CONCURRENT_MARK
+    ggggc_retireSATB();
+#endif
+#ifdef GGGGC_GENERATIONAL
+    ggggc_retireNursery();
+#endif
+
     /* now remove this thread from the thread barrier */
     while (ggc_mutex_trylock(&ggggc_worldBarrierLock) != 0)
         GGC_YIELD();
@@ -55,18 +64,22 @@ static void *ggggcThreadWrapper(void *arg)
     }
     ggc_mutex_unlock(&ggggc_worldBarrierLock);
 
-    /* and give back its pools */
-    ggggc_freeGeneration(ggggc_gen0);
-
     return 0;
 }
 
-static ggc_thread_local struct GGGGC_PoolList blockedPoolListNode;
 static ggc_thread_local struct GGGGC_PointerStackList blockedPointerStackListNode;
+static ggc_thread_local struct GGGGC_JITPointerStackList blockedJITPointerStackListNode;
 
 /* call this before blocking */
 void ggc_pre_blocking()
 {
+    /* the world may be stopped without us, so our TLAB can't be left in the
+     * heap, nor our SATB buffer with us */
+    ggggc_retireTLAB();
+#ifdef GGGGC_CONCURRENT_MARK
+    ggggc_retireSATB();
+#endif
+
     /* get a lock on the thread count etc */
     while (ggc_mutex_trylock(&ggggc_worldBarrierLock) != 0)
         GGC_YIELD();
@@ -78,13 +91,14 @@ void ggc_pre_blocking()
         ggc_barrier_init(&ggggc_worldBarrier, ggggc_threadCount);
     }
 
-    /* add our roots and pools */
-    blockedPoolListNode.pool = ggggc_gen0;
-    blockedPoolListNode.next = ggggc_blockedThreadPool0s;
-    ggggc_blockedThreadPool0s = &blockedPoolListNode;
+    /* add our roots */
     blockedPointerStackListNode.pointerStack = ggggc_pointerStack;
     blockedPointerStackListNode.next = ggggc_blockedThreadPointerStacks;
     ggggc_blockedThreadPointerStacks = &blockedPointerStackListNode;
+    blockedJITPointerStackListNode.cur = ggc_jitPointerStack;
+    blockedJITPointerStackListNode.top = ggc_jitPointerStackTop;
+    blockedJITPointerStackListNode.next = ggggc_blockedThreadJITPointerStacks;
+    ggggc_blockedThreadJITPointerStacks = &blockedJITPointerStackListNode;
 
     ggc_mutex_unlock(&ggggc_worldBarrierLock);
 }
@@ -92,8 +106,8 @@ void ggc_pre_blocking()
 /* and this after */
 void ggc_post_blocking()
 {
-    struct GGGGC_PoolList *plCur;
     struct GGGGC_PointerStackList *pslCur;
+    struct GGGGC_JITPointerStackList *jpslCur;
 
     /* get a lock on the thread count etc */
     while (ggc_mutex_trylock(&ggggc_worldBarrierLock) != 0);
@@ -105,26 +119,26 @@ void ggc_post_blocking()
     ggc_barrier_destroy(&ggggc_worldBarrier);
     ggc_barrier_init(&ggggc_worldBarrier, ++ggggc_threadCount);
 
-    /* remove our roots and pools from the list */
-    if (ggggc_blockedThreadPool0s == &blockedPoolListNode) {
-        ggggc_blockedThreadPool0s = ggggc_blockedThreadPool0s->next;
+    /* remove our roots from the list */
+    if (ggggc_blockedThreadPointerStacks == &blockedPointerStackListNode) {
+        ggggc_blockedThreadPointerStacks = ggggc_blockedThreadPointerStacks->next;
 
     } else {
-        for (plCur = ggggc_blockedThreadPool0s; plCur->next; plCur = plCur->next) {
-            if (plCur->next == &blockedPoolListNode) {
-                plCur->next = plCur->next->next;
+        for (pslCur = ggggc_blockedThreadPointerStacks; pslCur->next; pslCur = pslCur->next) {
+            if (pslCur->next == &blockedPointerStackListNode) {
+                pslCur->next = pslCur->next->next;
                 break;
             }
         }
 
     }
-    if (ggggc_blockedThreadPointerStacks == &blockedPointerStackListNode) {
-        ggggc_blockedThreadPointerStacks = ggggc_blockedThreadPointerStacks->next;
+    if (ggggc_blockedThreadJITPointerStacks == &blockedJITPointerStackListNode) {
+        ggggc_blockedThreadJITPointerStacks = ggggc_blockedThreadJITPointerStacks->next;
 
     } else {
-        for (pslCur = ggggc_blockedThreadPointerStacks; pslCur->next; pslCur = pslCur->next) {
-            if (pslCur->next == &blockedPointerStackListNode) {
-                pslCur->next = pslCur->next->next;
+        for (jpslCur = ggggc_blockedThreadJITPointerStacks; jpslCur->next; jpslCur = jpslCur->next) {
+            if (jpslCur->next == &blockedJITPointerStackListNode) {
+                jpslCur->next = jpslCur->next->next;
                 break;
             }
         }
@@ -50,6 +50,7 @@
  *  (8).
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -168,6 +169,41 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
     C2(MOV, RDI, MEM(8, RBP, 0, RNONE, -8)); \
 } while(0)
 
+        /* offsets of members within GC'd objects, for inline accesses */
+#define PTR_OFFSET(type, member) offsetof(struct type ## __ggggc_struct, member ## __ptr)
+#define DATA_OFFSET(type, member) offsetof(struct type ## __ggggc_struct, member ## __data)
+#define ARRAY_OFFSET(type) offsetof(struct type ## __ggggc_parray, a__ptrs)
+
+        /* macro to box an int into RAX. It's a SMI (see value.h) unless it
+         * doesn't fit, in which case sdyn_boxInt boxes it */
+#define BOX_INT(reg) do { \
+    size_t big, boxed; \
+    C2(MOV, RSI, reg); \
+    C2(MOV, RAX, RSI); \
+    C2(ADD, RAX, RAX); \
+    CF(JOF, big); \
+    C2(OR, RAX, IMM(1)); \
+    CF(JMPF, boxed); \
+    L(big); \
+    IMM64P(RAX, sdyn_boxInt); \
+    JCALL(RAX); \
+    L(boxed); \
+} while(0)
+
+        /* macro to unbox an int in either representation from the register
+         * src to the register dst */
+#define UNBOX_INT(dst, src) do { \
+    size_t boxed, unboxed; \
+    C2(MOV, dst, src); \
+    C2(TEST, dst, IMM(1)); \
+    CF(JEF, boxed); \
+    C2(SAR, dst, IMM(1)); \
+    CF(JMPF, unboxed); \
+    L(boxed); \
+    C2(MOV, dst, MEM(8, dst, 0, RNONE, DATA_OFFSET(SDyn_Number, value))); \
+    L(unboxed); \
+} while(0)
+
         /* macro to box a value of any type */
 #define BOX(type, targ, reg) do { \
     switch (type) { \
@@ -184,9 +220,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
             break; \
             \
         case SDYN_TYPE_INT: \
-            C2(MOV, RSI, reg); \
-            IMM64P(RAX, sdyn_boxInt); \
-            JCALL(RAX); \
+            BOX_INT(reg); \
             C2(MOV, targ, RAX); \
             break; \
             \
@@ -195,6 +229,30 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
     } \
 } while(0)
 
+        /* macro to check one inline cache entry (see INLINE_CACHE below) */
+#define INLINE_CACHE_ENTRY(n, hit) do { \
+    size_t next; \
+    C2(CMP, RDX, MEM(8, RAX, 0, RNONE, PTR_OFFSET(SDyn_InlineCache, shape ## n))); \
+    CF(JNEF, next); \
+    C2(MOV, RAX, MEM(8, RAX, 0, RNONE, DATA_OFFSET(SDyn_InlineCache, index ## n))); \
+    CF(JMPF, hit); \
+    L(next); \
+} while(0)
+
+        /* macro to look up the object in RSI in the inline cache pointed to by
+         * gcache. On a hit, jumps to one of hits with the member's index in
+         * RAX. On a miss, falls through with the cache in RDX */
+#define INLINE_CACHE(gcache, hits) do { \
+    IMM64P(RAX, gcache); \
+    C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 0)); \
+    C2(MOV, RDX, MEM(8, RSI, 0, RNONE, PTR_OFFSET(SDyn_Object, shape))); \
+    INLINE_CACHE_ENTRY(0, hits[0]); \
+    INLINE_CACHE_ENTRY(1, hits[1]); \
+    INLINE_CACHE_ENTRY(2, hits[2]); \
+    INLINE_CACHE_ENTRY(3, hits[3]); \
+    C2(MOV, RDX, RAX); \
+} while(0)
+
         /* choose our target based on the storage type */
         switch (GGC_RD(node, stype)) {
             case SDYN_STORAGE_STK:
@@ -439,7 +497,8 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 
             case SDYN_NODE_MEMBER:
             {
-                SDyn_String *gstring;
+                SDyn_InlineCache *gcache;
+                size_t hits[SDYN_INLINE_CACHE_SIZE], done, j;
 
                 LOADOP(left, RAX);
                 BOX(leftType, RSI, left);
@@ -451,23 +510,34 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                     C2(MOV, RSI, RAX);
                 }
 
-                /* put the string member name somewhere to load at runtime */
-                gstring = (SDyn_String *) createPointer();
-                *gstring = GGC_RP(node, immp);
-                IMM64P(RDX, gstring);
-                C2(MOV, RDX, MEM(8, RDX, 0, RNONE, 0));
+                /* make an inline cache for this member, globally accessible */
+                gcache = (SDyn_InlineCache *) createPointer();
+                *gcache = sdyn_newInlineCache((SDyn_String) GGC_RP(node, immp));
 
-                /* get everything into place and call */
-                IMM64P(RAX, sdyn_getObjectMember);
+                /* on a miss, the runtime finds the member and fills the cache */
+                INLINE_CACHE(gcache, hits);
+                IMM64P(RAX, sdyn_getObjectMemberIC);
                 JCALL(RAX);
+                CF(JMPF, done);
 
+                /* on a hit, just load it */
+                for (j = 0; j < SDYN_INLINE_CACHE_SIZE; j++)
+                    L(hits[j]);
+                C2(MOV, RDX, MEM(8, RSI, 0, RNONE, PTR_OFFSET(SDyn_Object, members)));
+                C2(MOV, RAX, MEM(8, RDX, 8, RAX, ARRAY_OFFSET(SDyn_Undefined)));
+
+                L(done);
                 C2(MOV, target, RAX);
                 break;
             }
 
             case SDYN_NODE_ASSIGNMEMBER:
             {
-                SDyn_String *gstring;
+                SDyn_InlineCache *gcache;
+                size_t hits[SDYN_INLINE_CACHE_SIZE], done, j;
+#ifdef GGGGC_CONCURRENT_MARK
+                size_t barrier, done2;
+#endif
 
                 LOADOP(left, RAX);
                 BOX(leftType, RSI, left);
@@ -485,16 +555,49 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 BOX(rightType, RCX, right);
                 C2(MOV, RSI, MEM(8, RDI, 0, RNONE, 0));
 
-                /* make the string globally accessible */
-                gstring = (SDyn_String *) createPointer();
-                *gstring = GGC_RP(node, immp);
-                IMM64P(RDX, gstring);
-                C2(MOV, RDX, MEM(8, RDX, 0, RNONE, 0));
+                /* make an inline cache for this member, globally accessible */
+                gcache = (SDyn_InlineCache *) createPointer();
+                *gcache = sdyn_newInlineCache((SDyn_String) GGC_RP(node, immp));
 
-                /* get everything into place and call */
-                IMM64P(RAX, sdyn_setObjectMember);
+                /* on a miss, the runtime sets the member and fills the cache */
+                INLINE_CACHE(gcache, hits);
+                IMM64P(RAX, sdyn_setObjectMemberIC);
+                JCALL(RAX);
+                CF(JMPF, done);
+
+                /* on a hit, just store it. Of GGC_WAP's barrier, only the SATB
+                 * barrier while marking concurrently and the generational
+                 * heap's card marking matter to our collectors */
+                for (j = 0; j < SDYN_INLINE_CACHE_SIZE; j++)
+                    L(hits[j]);
+#ifdef GGGGC_CONCURRENT_MARK
+                IMM64P(RDX, &ggggc_concurrentMarking);
+                C2(MOV, RDX, MEM(8, RDX, 0, RNONE, 0));
+                C2(TEST, RDX, RDX);
+                CF(JNEF, barrier);
+#endif
+                C2(MOV, RDX, MEM(8, RSI, 0, RNONE, PTR_OFFSET(SDyn_Object, members)));
+                C2(MOV, MEM(8, RDX, 8, RAX, ARRAY_OFFSET(SDyn_Undefined)), RCX);
+#ifdef GGGGC_GENERATIONAL
+                /* mark the members array's card, whichever generation it's in */
+                C2(MOV, RAX, RDX);
+                C2(SHR, RAX, IMM(GGGGC_POOL_SIZE));
+                C2(SHL, RAX, IMM(GGGGC_POOL_SIZE));
+                C2(SHL, RDX, IMM(64 - GGGGC_POOL_SIZE));
+                C2(SHR, RDX, IMM(64 - GGGGC_POOL_SIZE + GGGGC_CARD_SIZE));
+                C2(MOV, MEM(1, RAX, 1, RDX, 0), IMM(1));
+#endif
+#ifdef GGGGC_CONCURRENT_MARK
+                CF(JMPF, done2);
+
+                L(barrier);
+                C2(MOV, RDX, RAX);
+                IMM64P(RAX, sdyn_setObjectMemberIndex);
                 JCALL(RAX);
+                L(done2);
+#endif
 
+                L(done);
                 LOADOP(right, RAX);
                 C2(MOV, target, RAX);
                 break;
@@ -567,11 +670,15 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                     if ((leftType == SDYN_TYPE_BOXED_UNDEFINED) && (targetType == SDYN_TYPE_UNDEFINED)) {
                         /* no unboxing required for undefined */
 
-                    } else if (((leftType == SDYN_TYPE_BOXED_BOOL) && (targetType == SDYN_TYPE_BOOL)) ||
-                               ((leftType == SDYN_TYPE_BOXED_INT) && (targetType == SDYN_TYPE_INT))) {
+                    } else if ((leftType == SDYN_TYPE_BOXED_BOOL) && (targetType == SDYN_TYPE_BOOL)) {
                         /* unbox the value */
                         C2(MOV, target, MEM(8, RSI, 0, RNONE, 8));
 
+                    } else if ((leftType == SDYN_TYPE_BOXED_INT) && (targetType == SDYN_TYPE_INT)) {
+                        /* unbox the value */
+                        UNBOX_INT(RAX, RSI);
+                        C2(MOV, target, RAX);
+
                     } else if ((leftType == SDYN_TYPE_UNDEFINED) && (targetType == SDYN_TYPE_BOXED_UNDEFINED)) {
                         /* box the undefined value */
                         IMM64P(RAX, &sdyn_undefined);
@@ -585,8 +692,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 
                     } else if ((leftType == SDYN_TYPE_INT) && (targetType == SDYN_TYPE_BOXED_INT)) {
                         /* box the int */
-                        IMM64P(RAX, sdyn_boxInt);
-                        JCALL(RAX);
+                        BOX_INT(RSI);
                         C2(MOV, target, RAX);
 
                     } else {
@@ -614,10 +720,18 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                  *     struct Descriptor *tagDescriptor;
                  *     long tag;
                  * };
+                 * SMIs have no descriptor, but are always ints.
                  */
-                C2(MOV, RAX, MEM(8, RSI, 0, RNONE, 0)); /* get the descriptor */
-                C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 8)); /* get the tag box */
-                C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 8)); /* get the tag */
+                {
+                    size_t smi;
+                    C2(MOV, RAX, IMM(SDYN_TYPE_BOXED_INT));
+                    C2(TEST, RSI, IMM(1));
+                    CF(JNEF, smi);
+                    C2(MOV, RAX, MEM(8, RSI, 0, RNONE, 0)); /* get the descriptor */
+                    C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 8)); /* get the tag box */
+                    C2(MOV, RAX, MEM(8, RAX, 0, RNONE, 8)); /* get the tag */
+                    L(smi);
+                }
 
                 /* now we check if the tag is what we expect */
                 {
@@ -677,9 +791,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
             case SDYN_NODE_NUM:
                 C2(MOV, target, IMM(GGC_RD(node, imm)));
                 if (targetType >= SDYN_TYPE_FIRST_BOXED) {
-                    C2(MOV, RSI, target);
-                    IMM64P(RAX, &sdyn_boxInt);
-                    JCALL(RAX);
+                    BOX_INT(target);
                     C2(MOV, target, RAX);
                 }
                 break;
@@ -795,22 +907,21 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
             {
                 LOADOP(left, RSI);
                 LOADOP(right, RDX);
-                if (leftType != rightType) {
-                    /* we can unbox numbers to get compatible types */
-                    if (leftType == SDYN_TYPE_INT && rightType == SDYN_TYPE_BOXED_INT) {
-                        C2(MOV, right, MEM(8, right, 0, RNONE, 8));
-                        rightType = SDYN_TYPE_INT;
+                /* we can unbox numbers to get compatible types */
+                if (leftType == SDYN_TYPE_INT && rightType == SDYN_TYPE_BOXED_INT) {
+                    UNBOX_INT(right, right);
+                    rightType = SDYN_TYPE_INT;
 
-                    } else if (leftType == SDYN_TYPE_BOXED_INT && rightType == SDYN_TYPE_INT) {
-                        C2(MOV, left, MEM(8, left, 0, RNONE, 8));
-                        leftType = SDYN_TYPE_INT;
+                } else if (leftType == SDYN_TYPE_BOXED_INT && rightType == SDYN_TYPE_INT) {
+                    UNBOX_INT(left, left);
+                    leftType = SDYN_TYPE_INT;
 
-                    } else if (leftType == SDYN_TYPE_BOXED_INT && rightType == SDYN_TYPE_BOXED_INT) {
-                        C2(MOV, left, MEM(8, left, 0, RNONE, 8));
-                        C2(MOV, right, MEM(8, right, 0, RNONE, 8));
-                        leftType = rightType = SDYN_TYPE_INT;
+                } else if (leftType == SDYN_TYPE_BOXED_INT && rightType == SDYN_TYPE_BOXED_INT) {
+                    /* (boxed ints can't be compared by identity) */
+                    UNBOX_INT(left, left);
+                    UNBOX_INT(right, right);
+                    leftType = rightType = SDYN_TYPE_INT;
 
-                    }
                 }
 
                 /* we always put our result in RAX, for later moving */
@@ -877,7 +988,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 LOADOP(left, RAX);
                 switch (leftType) {
                     case SDYN_TYPE_BOXED_INT:
-                        C2(MOV, RAX, MEM(8, left, 0, RNONE, 8));
+                        UNBOX_INT(RAX, left);
                         C2(MOV, intLeft, RAX);
                         break;
 
@@ -899,7 +1010,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 LOADOP(right, RDX);
                 switch (rightType) {
                     case SDYN_TYPE_BOXED_INT:
-                        C2(MOV, RDX, MEM(8, right, 0, RNONE, 8));
+                        UNBOX_INT(RDX, right);
                         break;
 
                     case SDYN_TYPE_INT:
@@ -997,8 +1108,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                                 /* may as well box now */
                                 C2(MOV, RSI, left);
                                 C2(ADD, RSI, right);
-                                IMM64P(RAX, sdyn_boxInt);
-                                JCALL(RAX);
+                                BOX_INT(RSI);
 
                             } else {
                                 /* just add! */
@@ -1009,23 +1119,15 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                             break;
 
                         case SDYN_TYPE_BOXED_INT:
-                        {
-                            struct SJA_X8664_Operand tmpTarget = RAX;
-                            if (targetType >= SDYN_TYPE_FIRST_BOXED) tmpTarget = RSI;
-
                             /* the only boxed case we actually care to unbox */
-                            C2(MOV, tmpTarget, left);
-                            C2(MOV, tmpTarget, MEM(8, RAX, 0, RNONE, 8));
-                            C2(MOV, RDX, right);
-                            C2(ADD, tmpTarget, MEM(8, RDX, 0, RNONE, 8));
+                            UNBOX_INT(RAX, left);
+                            UNBOX_INT(RDX, right);
+                            C2(ADD, RAX, RDX);
 
                             /* rebox the result if asked */
-                            if (targetType >= SDYN_TYPE_FIRST_BOXED) {
-                                IMM64P(RAX, sdyn_boxInt);
-                                JCALL(RAX);
-                            }
+                            if (targetType >= SDYN_TYPE_FIRST_BOXED)
+                                BOX_INT(RAX);
                             break;
-                        }
 
                         default:
                             /* something boxed, just count on the generic adder */
@@ -1084,7 +1186,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 LOADOP(left, RAX);
                 switch (leftType) {
                     case SDYN_TYPE_BOXED_INT:
-                        C2(MOV, RAX, MEM(8, left, 0, RNONE, 8));
+                        UNBOX_INT(RAX, left);
                         C2(MOV, intLeft, RAX);
                         break;
 
@@ -1107,7 +1209,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
                 LOADOP(right, RSI);
                 switch (rightType) {
                     case SDYN_TYPE_BOXED_INT:
-                        C2(MOV, RSI, MEM(8, right, 0, RNONE, 8));
+                        UNBOX_INT(RSI, right);
                         break;
 
                     case SDYN_TYPE_INT:
@@ -1141,9 +1243,7 @@ sdyn_native_function_t sdyn_compile(SDyn_IRNodeArray ir)
 
                 /* and return */
                 if (targetType >= SDYN_TYPE_FIRST_BOXED) {
-                    C2(MOV, RSI, result);
-                    IMM64P(RAX, sdyn_boxInt);
-                    JCALL(RAX);
+                    BOX_INT(result);
                     C2(MOV, target, RAX);
                 } else {
                     C2(MOV, target, result);